@@ -54,8 +54,10 @@ bool isAnimationFile(const char filename []) {
         return false;
     }
 
+    // .FGF is the pre-decoded fast playback format, made from a GIF with
+    // extras/host/GifTranscode.cpp
     filenameString.toUpperCase();
-    if (filenameString.endsWith(".GIF") != 1)
+    if (filenameString.endsWith(".GIF") != 1 && filenameString.endsWith(".FGF") != 1)
         return false;
 
     return true;
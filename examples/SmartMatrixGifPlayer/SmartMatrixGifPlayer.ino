@@ -156,11 +156,43 @@ void drawPixelCallback(int16_t x, int16_t y, uint8_t red, uint8_t green, uint8_t
 #endif
 }
 
+#if (USE_SMARTMATRIX == 1)
+// Room to save the part of the screen drawn over by a frame that's restored
+// afterwards (disposal method 3), the screen is cleared for larger frames
+#define RESTORE_BUFFER_PIXELS (kMatrixWidth * kMatrixHeight / 4)
+rgb24 restoreBuffer[RESTORE_BUFFER_PIXELS];
+#endif
+
+bool saveRectCallback(int16_t x, int16_t y, int16_t width, int16_t height) {
+#if (USE_SMARTMATRIX == 1)
+    if (width * height > RESTORE_BUFFER_PIXELS)
+        return false;
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++)
+            restoreBuffer[j * width + i] = backgroundLayer.readPixel(x + i, y + j);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void restoreRectCallback(int16_t x, int16_t y, int16_t width, int16_t height) {
+#if (USE_SMARTMATRIX == 1)
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++)
+            backgroundLayer.drawPixel(x + i, y + j, restoreBuffer[j * width + i]);
+    }
+#endif
+}
+
 // Setup method runs once, when the sketch starts
 void setup() {
     decoder.setScreenClearCallback(screenClearCallback);
     decoder.setUpdateScreenCallback(updateScreenCallback);
     decoder.setDrawPixelCallback(drawPixelCallback);
+    decoder.setSaveRectCallback(saveRectCallback);
+    decoder.setRestoreRectCallback(restoreRectCallback);
 
     decoder.setFileSeekCallback(fileSeekCallback);
     decoder.setFilePositionCallback(filePositionCallback);
@@ -260,6 +292,10 @@ void loop() {
         nextGIF = 1;
 #endif
 
+    // a GIF with a loop count stops on its last frame when it's played that many times
+    if(decoder.isFinished())
+        nextGIF = 1;
+
     if(nextGIF)
     {
         if (openGifFilenameByIndex(GIF_DIRECTORY, index) >= 0) {
@@ -27,7 +27,12 @@
  */
 
 /*
- * This SmartMatrix Library example displays GIF animations loaded from a SD Card connected to the Teensy 3
+ * This SmartMatrix Library example displays GIF animations loaded from a SD Card connected to the Teensy 3,
+ * and prints where the decoder spent its time to Serial after playing each GIF
+ *
+ * The decoder is built with GIF_PROFILING, and times each phase of decoding: parsing headers and extensions,
+ * pre-scanning the LZW sub-blocks, LZW decoding, composing (disposal), output callbacks, and waiting for the
+ * frame delay.  Phase times are in microseconds, or CPU cycles with PROFILE_CYCLES set to 1 on Teensy
  *
  * The example can be modified to drive displays other than SmartMatrix by replacing SmartMatrix Library calls in setup() and
  * the *Callback() functions with calls to a different library (look for the USE_SMARTMATRIX and ENABLE_SCROLLING blocks and replace)
@@ -76,6 +81,14 @@
 #include <SmartMatrix3.h>
 
 #include <SD.h>
+
+// Count CPU cycles instead of microseconds (Teensy only)
+#define PROFILE_CYCLES 0
+
+#define GIF_PROFILING
+#if (PROFILE_CYCLES == 1)
+#define GIF_PROFILE_CLOCK() ARM_DWT_CYCCNT
+#endif
 #include <GifDecoder.h>
 #include "FilenameFunctions.h"
 
@@ -137,6 +150,9 @@ GifDecoder<kMatrixWidth, kMatrixHeight, 12> decoder;
 
 int num_files;
 
+// longest time taken by one frame, not counting the wait for the frame delay
+uint32_t maxFrameTime;
+
 void screenClearCallback(void) {
 #if (USE_SMARTMATRIX == 1)
   backgroundLayer.fillScreen({0,0,0});
@@ -172,7 +188,13 @@ void setup() {
 #endif
 
     Serial.begin(115200);
-    Serial.println("Starting AnimatedGIFs Sketch");
+    Serial.println("Starting AnimatedGIFs Profiling Sketch");
+
+#if (PROFILE_CYCLES == 1)
+    // enable the cycle counter
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+#endif
 
 
 #if (USE_SMARTMATRIX == 1)
@@ -237,10 +259,40 @@ void setup() {
 }
 
 
+// Print the stats collected since the GIF was started
+void printProfile() {
+    const gif_profile &profile = decoder.getTotalProfile();
+
+    if(!profile.frames)
+        return;
+
+    uint32_t total = 0;
+    for(int i = 0; i < GIF_PHASE_COUNT; i++)
+        total += profile.phaseTime[i];
+
+    Serial.print("Frames: ");
+    Serial.print(profile.frames);
+    Serial.print("  bytes read/frame: ");
+    Serial.print(profile.bytesRead / profile.frames);
+    Serial.print("  seeks/frame: ");
+    Serial.print((float)profile.seeks / profile.frames);
+    Serial.print("  max frame: ");
+    Serial.println(maxFrameTime);
+
+    for(int i = 0; i < GIF_PHASE_COUNT; i++) {
+        Serial.print("  ");
+        Serial.print(decoder.getPhaseName(i));
+        Serial.print(": ");
+        Serial.print(profile.phaseTime[i] / profile.frames);
+        Serial.print("/frame  ");
+        Serial.print(total ? (100.0 * profile.phaseTime[i] / total) : 0);
+        Serial.println("%");
+    }
+}
+
 void loop() {
     static unsigned long displayStartTime_millis;
     static int nextGIF = 1;     // we haven't loaded a GIF yet on first pass through, make sure we do that
-    static unsigned long lastDecodeTime_millis;
 
     unsigned long now = millis();
 
@@ -260,8 +312,15 @@ void loop() {
         nextGIF = 1;
 #endif
 
+    // a GIF with a loop count stops on its last frame when it's played that many times
+    if(decoder.isFinished())
+        nextGIF = 1;
+
     if(nextGIF)
     {
+        printProfile();
+        maxFrameTime = 0;
+
         if (openGifFilenameByIndex(GIF_DIRECTORY, index) >= 0) {
             // Can clear screen for new animation here, but this might cause flicker with short animations
             // matrix.fillScreen(COLOR_BLACK);
@@ -281,5 +340,14 @@ void loop() {
         nextGIF = 0;
     }
 
-    decoder.decodeFrame();
+    if(decoder.decodeFrame() == 0) {
+        const gif_profile &frame = decoder.getFrameProfile();
+        uint32_t frameTime = 0;
+        for(int i = 0; i < GIF_PHASE_COUNT; i++) {
+            if(i != GIF_PHASE_WAIT)
+                frameTime += frame.phaseTime[i];
+        }
+        if(frameTime > maxFrameTime)
+            maxFrameTime = frameTime;
+    }
 }
@@ -0,0 +1,82 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * Just enough of the Arduino API (Serial, micros, millis, delay) to build the
+ * GifDecoder library for a desktop host.  Include this before GifDecoder.h
+ */
+
+#ifndef ARDUINO_SHIM_H
+#define ARDUINO_SHIM_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define HEX 16
+#define DEC 10
+
+// Serial output goes to stderr so it doesn't mix with a tool's results
+class HostSerial {
+public:
+  void print(const char *s) { fputs(s, stderr); }
+  void print(char c) { fputc(c, stderr); }
+  void print(long n, int base = DEC) {
+    fprintf(stderr, (base == HEX) ? "%lX" : "%ld", n);
+  }
+  void print(unsigned long n, int base = DEC) {
+    fprintf(stderr, (base == HEX) ? "%lX" : "%lu", n);
+  }
+  void print(int n, int base = DEC) { print((long)n, base); }
+  void print(unsigned int n, int base = DEC) { print((unsigned long)n, base); }
+  void print(uint8_t n, int base = DEC) { print((unsigned long)n, base); }
+
+  template <typename T> void println(T t) {
+    print(t);
+    println();
+  }
+  template <typename T> void println(T t, int base) {
+    print(t, base);
+    println();
+  }
+  void println(void) { fputc('\n', stderr); }
+
+  int read(void) { return -1; }
+};
+
+static HostSerial Serial;
+
+// A tool that checks timing defines HOST_MANUAL_CLOCK, then micros() is
+// hostMicros, which only moves when the tool moves it
+#if defined(HOST_MANUAL_CLOCK)
+static uint32_t hostMicros;
+
+static inline uint32_t micros(void) { return hostMicros; }
+#else
+static inline uint32_t micros(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+#endif
+
+static inline uint32_t millis(void) { return micros() / 1000; }
+
+static inline void delay(uint32_t ms) {
+  struct timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (long)(ms % 1000) * 1000000;
+  nanosleep(&ts, NULL);
+}
+
+// Not part of the Arduino API: a finer clock for timing on the host, wraps
+// every ~4.3 seconds like micros() does every ~71 minutes
+static inline uint32_t hostNanos(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * Microbenchmark for the disposal kernels: filling a rectangle of the canvas
+ * with the background (disposal method 2) and copying it to and from the
+ * backup canvas (disposal method 3), on 32x32 to 256x256 canvases, for the
+ * whole canvas, half of it and a small rectangle.  Each is timed with the
+ * per-byte loops the decoder used before and with gifFillRect() and
+ * gifCopyRect(), which work a row at a time, or in one go for whole rows.  The
+ * line-streaming background fill is timed per line and once per frame.
+ *
+ * The kernels are a memset() or memcpy() per row.  The MCU toolchains call the
+ * library's, but GCC on x86 expands them inline as rep stos/movs, which are
+ * slow to start on short rows, so on x86 build with -mstringop-strategy=libcall
+ * to time what the MCUs run.  Build and run from this directory:
+ *   c++ -O2 -mstringop-strategy=libcall -I../../src -o disposalbench \
+ *       DisposalBench.cpp
+ *   ./disposalbench [-n iterations]
+ */
+
+#include "ArduinoShim.h"
+
+#include <unistd.h>
+
+#include <GifDecoder.h>
+
+#define BENCH_MAX_SIZE 256
+
+static uint8_t canvasBuffer[BENCH_MAX_SIZE * BENCH_MAX_SIZE];
+static uint8_t backupBuffer[BENCH_MAX_SIZE * BENCH_MAX_SIZE];
+
+// Through pointers the compiler can't see the target of, like the decoder's
+// imageData, so it doesn't specialize the kernels for these buffers
+static uint8_t *volatile canvasPointer = canvasBuffer;
+static uint8_t *volatile backupPointer = backupBuffer;
+
+static int iterations = 2000;
+
+// The loops fillImageDataRect() and copyImageDataRect() used before
+__attribute__((noinline)) static void fillPerByte(uint8_t *buf, int stride,
+                                                  uint8_t value, int x, int y,
+                                                  int width, int height) {
+  for (int yy = y; yy < height + y; yy++) {
+    int yOffset = yy * stride;
+    for (int xx = x; xx < width + x; xx++) {
+      buf[yOffset + xx] = value;
+    }
+  }
+}
+
+__attribute__((noinline)) static void copyPerByte(uint8_t *dst,
+                                                  const uint8_t *src,
+                                                  int stride, int x, int y,
+                                                  int width, int height) {
+  for (int yy = y; yy < height + y; yy++) {
+    int yOffset = yy * stride;
+    for (int xx = x; xx < width + x; xx++) {
+      dst[yOffset + xx] = src[yOffset + xx];
+    }
+  }
+}
+
+__attribute__((noinline)) static void fillRowWise(uint8_t *buf, int stride,
+                                                  uint8_t value, int x, int y,
+                                                  int width, int height) {
+  gifFillRect(buf, stride, value, x, y, width, height);
+}
+
+__attribute__((noinline)) static void copyRowWise(uint8_t *dst,
+                                                  const uint8_t *src,
+                                                  int stride, int x, int y,
+                                                  int width, int height) {
+  gifCopyRect(dst, src, stride, x, y, width, height);
+}
+
+// The background around a frame in the line-streaming path, filled for every
+// line of the frame before, and once per frame now
+__attribute__((noinline)) static void lineFillPerLine(uint8_t *line,
+                                                      int width, int height) {
+  for (int y = 0; y < height; y++) {
+    memset(line, y, width);
+    // stands in for the frame's pixels decoded into the line
+    line[width / 2] ^= 1;
+  }
+}
+
+__attribute__((noinline)) static void lineFillOnce(uint8_t *line, int width,
+                                                   int height) {
+  memset(line, 0, width);
+  for (int y = 0; y < height; y++) {
+    line[width / 2] ^= 1;
+  }
+}
+
+// Nanoseconds per call of each kernel, both timed for the same rectangle
+static void benchmarkRect(const char *name, int size, int x, int y, int width,
+                          int height) {
+  uint8_t *canvas = canvasPointer;
+  uint8_t *backup = backupPointer;
+
+  uint32_t start = hostNanos();
+  for (int i = 0; i < iterations; i++)
+    fillPerByte(canvas, size, i, x, y, width, height);
+  double fillBefore = (double)(hostNanos() - start) / iterations;
+
+  start = hostNanos();
+  for (int i = 0; i < iterations; i++)
+    fillRowWise(canvas, size, i, x, y, width, height);
+  double fillAfter = (double)(hostNanos() - start) / iterations;
+
+  start = hostNanos();
+  for (int i = 0; i < iterations; i++)
+    copyPerByte(i & 1 ? canvas : backup, i & 1 ? backup : canvas, size, x, y,
+                width, height);
+  double copyBefore = (double)(hostNanos() - start) / iterations;
+
+  start = hostNanos();
+  for (int i = 0; i < iterations; i++)
+    copyRowWise(i & 1 ? canvas : backup, i & 1 ? backup : canvas, size, x, y,
+                width, height);
+  double copyAfter = (double)(hostNanos() - start) / iterations;
+
+  printf("%3dx%-3d %-6s fill:%9.1f ->%9.1f ns (x%.1f)  copy:%9.1f ->%9.1f "
+         "ns (x%.1f)\n",
+         size, size, name, fillBefore, fillAfter, fillBefore / fillAfter,
+         copyBefore, copyAfter, copyBefore / copyAfter);
+}
+
+static void benchmarkLineFill(int size) {
+  uint8_t *line = canvasPointer;
+
+  uint32_t start = hostNanos();
+  for (int i = 0; i < iterations; i++)
+    lineFillPerLine(line, size, size);
+  double before = (double)(hostNanos() - start) / iterations;
+
+  start = hostNanos();
+  for (int i = 0; i < iterations; i++)
+    lineFillOnce(line, size, size);
+  double after = (double)(hostNanos() - start) / iterations;
+
+  printf("%3dx%-3d %-6s background per frame:%9.1f ->%9.1f ns (x%.1f)\n",
+         size, size, "stream", before, after, before / after);
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+    case 'n':
+      iterations = atoi(optarg);
+      break;
+    default:
+      iterations = 0;
+      break;
+    }
+  }
+  if (optind < argc || iterations < 1) {
+    fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+    return 1;
+  }
+
+  for (int size = 32; size <= BENCH_MAX_SIZE; size *= 2) {
+    benchmarkRect("full", size, 0, 0, size, size);
+    benchmarkRect("half", size, size / 4 + 1, size / 4, size / 2, size / 2);
+    // a small sprite somewhere in the middle, not aligned to a word
+    benchmarkRect("8x8", size, size / 2 - 3, size / 2 - 3, 8, 8);
+    benchmarkLineFill(size);
+  }
+  return 0;
+}
@@ -0,0 +1,464 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * Decodes a whole library of GIFs on every core, to check them and prepare
+ * them for displays.  The GIFs under each directory given (and any files
+ * given) are shared out between -j worker threads, each with a decoder of its
+ * own, on the pool in HostWorkerPool.h: a worker that runs out of files takes
+ * the last ones of another's.
+ *
+ * For each GIF one JSON line is printed, with its size, frame count and
+ * duration and the time it took, or the error if it couldn't be decoded:
+ *   {"file":"../gifs/star.gif","status":"ok","width":32,"height":32,
+ *    "frames":10,"duration_ms":1000,"ms":1.2,"worker":0}
+ * The exit status is 1 if any GIF failed.
+ *
+ * -f chooses what is written to -o, in the same tree of directories:
+ *   probe  nothing, just the JSON lines (the default)
+ *   raw    every frame as RGB, one after another, to a .rgb file
+ *   sheet  every frame, in a grid, to a .ppm sprite sheet
+ *   thumb  the first frame scaled to fit -s pixels square, to a .ppm file,
+ *          decoding nothing after it (so the JSON has just that frame)
+ * -c x,y,width,height crops the GIFs first, with the decoder's viewport.
+ *
+ * Build and run from this directory:
+ *   c++ -O2 -Wall -pthread -I../../src -o gifbatch GifBatch.cpp
+ *   ./gifbatch [-j threads] [-f probe|raw|sheet|thumb] [-o outdir]
+ *              [-s size] [-c x,y,width,height] file.gif|directory...
+ */
+
+#include "ArduinoShim.h"
+
+#define HOST_FILE_STORAGE static thread_local
+#include "HostFileFunctions.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HostWorkerPool.h"
+
+#include <GifDecoder.h>
+
+#define BATCH_MAX_WIDTH 1024
+#define BATCH_MAX_HEIGHT 1024
+
+// Sprite sheets of GIFs with more frames than this aren't written
+#define SHEET_MAX_BYTES (256UL * 1024 * 1024)
+
+enum { OUTPUT_PROBE, OUTPUT_RAW, OUTPUT_SHEET, OUTPUT_THUMB };
+
+static int output = OUTPUT_PROBE;
+static const char *outputDirectory;
+static int thumbSize = 64;
+static bool crop;
+static int cropX, cropY, cropWidth, cropHeight;
+
+// A GIF to decode, and its pathname relative to the directory it was found
+// in, for the output
+struct BatchFile {
+  std::string pathname;
+  std::string relative;
+};
+
+static std::vector<BatchFile> files;
+
+// Everything a worker decodes with.  The decoder's callbacks find it through
+// the thread's worker pointer
+struct Worker {
+  int number;
+  GifDecoder<BATCH_MAX_WIDTH, BATCH_MAX_HEIGHT, 12> decoder;
+  int width;
+  int height;
+  uint8_t canvas[BATCH_MAX_WIDTH * BATCH_MAX_HEIGHT * 3];
+  // The rectangle saved for a disposal method 3 frame
+  uint8_t saved[BATCH_MAX_WIDTH * BATCH_MAX_HEIGHT * 3];
+  std::vector<uint8_t> frames;
+};
+
+static std::vector<Worker *> workers;
+static thread_local Worker *worker;
+static HostWorkerPool *pool;
+
+static std::atomic<int> failures;
+static std::mutex reportLock;
+
+static void screenClearCallback(void) {
+  memset(worker->canvas, 0, sizeof(worker->canvas));
+}
+
+static void drawSpanCallback(int16_t x, int16_t y, int16_t len, uint8_t red,
+                             uint8_t green, uint8_t blue) {
+  if (y < 0 || y >= worker->height)
+    return;
+  int start = x < 0 ? 0 : x;
+  int end = min(x + len, worker->width);
+  uint8_t *p = worker->canvas + (y * BATCH_MAX_WIDTH + start) * 3;
+  for (int i = start; i < end; i++) {
+    *p++ = red;
+    *p++ = green;
+    *p++ = blue;
+  }
+}
+
+static void drawPixelCallback(int16_t x, int16_t y, uint8_t red, uint8_t green,
+                              uint8_t blue) {
+  drawSpanCallback(x, y, 1, red, green, blue);
+}
+
+// Disposal method 3 with NO_IMAGEDATA == 2: the worker keeps a copy of the
+// whole canvas size, so it can always save the rectangle
+static bool saveRectCallback(int16_t x, int16_t y, int16_t width,
+                             int16_t height) {
+  for (int row = y; row < y + height; row++) {
+    int offset = (row * BATCH_MAX_WIDTH + x) * 3;
+    memcpy(worker->saved + offset, worker->canvas + offset, width * 3);
+  }
+  return true;
+}
+
+static void restoreRectCallback(int16_t x, int16_t y, int16_t width,
+                                int16_t height) {
+  for (int row = y; row < y + height; row++) {
+    int offset = (row * BATCH_MAX_WIDTH + x) * 3;
+    memcpy(worker->canvas + offset, worker->saved + offset, width * 3);
+  }
+}
+
+static const char *errorName(int error) {
+  switch (error) {
+  case ERROR_FILEOPEN:
+    return "can't read the file";
+  case ERROR_FILENOTGIF:
+    return "not a GIF";
+  case ERROR_BADGIFFORMAT:
+    return "bad GIF format";
+  case ERROR_UNKNOWNCONTROLEXT:
+    return "unknown control extension";
+  case ERROR_TOOMANYCOLORS:
+    return "too many colors for imageData";
+  default:
+    return "no frames";
+  }
+}
+
+static void appendJsonString(std::string &s, const char *text) {
+  s += '"';
+  for (; *text; text++) {
+    if (*text == '"' || *text == '\\') {
+      s += '\\';
+      s += *text;
+    } else if ((uint8_t)*text < 0x20) {
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", (uint8_t)*text);
+      s += escape;
+    } else {
+      s += *text;
+    }
+  }
+  s += '"';
+}
+
+// Create the directories in pathname before its last component
+static bool makeParentDirectories(const std::string &pathname) {
+  for (size_t i = 1; i < pathname.size(); i++) {
+    if (pathname[i] != '/')
+      continue;
+    std::string directory = pathname.substr(0, i);
+    if (mkdir(directory.c_str(), 0777) < 0 && errno != EEXIST)
+      return false;
+  }
+  return true;
+}
+
+static std::string outputPathname(const BatchFile &file,
+                                  const char *extension) {
+  std::string pathname = std::string(outputDirectory) + "/" + file.relative;
+  size_t dot = pathname.rfind('.');
+  if (dot != std::string::npos && dot > pathname.rfind('/'))
+    pathname.erase(dot);
+  return pathname + extension;
+}
+
+static bool writePpm(const std::string &pathname, const uint8_t *rgb,
+                     int width, int height, int stride) {
+  if (!makeParentDirectories(pathname))
+    return false;
+  FILE *f = fopen(pathname.c_str(), "wb");
+  if (!f)
+    return false;
+  fprintf(f, "P6\n%d %d\n255\n", width, height);
+  for (int y = 0; y < height; y++)
+    fwrite(rgb + y * stride, 1, width * 3, f);
+  return fclose(f) == 0;
+}
+
+// The frames in a grid about as wide as it is high
+static bool writeSheet(const BatchFile &file, int frameCount) {
+  int width = worker->width;
+  int height = worker->height;
+  int columns = 1;
+  while (columns * columns < frameCount)
+    columns++;
+  int rows = (frameCount + columns - 1) / columns;
+  int stride = columns * width * 3;
+  std::vector<uint8_t> sheet((size_t)stride * rows * height);
+  for (int i = 0; i < frameCount; i++) {
+    const uint8_t *frame = &worker->frames[(size_t)i * width * height * 3];
+    uint8_t *cell =
+        &sheet[(size_t)(i / columns) * height * stride + (i % columns) * width * 3];
+    for (int y = 0; y < height; y++)
+      memcpy(cell + (size_t)y * stride, frame + y * width * 3, width * 3);
+  }
+  return writePpm(outputPathname(file, ".ppm"), sheet.data(), columns * width,
+                  rows * height, stride);
+}
+
+// The first frame scaled to fit thumbSize pixels square, which the decoder
+// draws straight into the thumbnail without decoding the rest of the GIF.
+// Returns the error, or NULL
+static const char *writeThumbnail(const BatchFile &file) {
+  int width = worker->width;
+  int height = worker->height;
+  int thumbWidth =
+      width >= height ? thumbSize : std::max(1, width * thumbSize / height);
+  int thumbHeight =
+      height >= width ? thumbSize : std::max(1, height * thumbSize / width);
+  std::vector<rgb_24> thumb(thumbWidth * thumbHeight);
+  int result = worker->decoder.decodePosterFrame(thumb.data(), thumbWidth,
+                                                 thumbHeight);
+  if (result != ERROR_NONE)
+    return errorName(result);
+  if (!writePpm(outputPathname(file, ".ppm"), (uint8_t *)thumb.data(),
+                thumbWidth, thumbHeight, thumbWidth * 3))
+    return "can't write the output";
+  return NULL;
+}
+
+static void processFile(int index) {
+  const BatchFile &file = files[index];
+  auto &decoder = worker->decoder;
+  uint32_t start = micros();
+
+  int frameCount = 0;
+  unsigned long duration = 0;
+  const char *error = NULL;
+  FILE *raw = NULL;
+  worker->frames.clear();
+
+  int result = ERROR_FILEOPEN;
+  if (openGifFile(file.pathname.c_str()) == 0)
+    result = decoder.startDecoding();
+  if (result < 0) {
+    error = errorName(result);
+  } else {
+    uint16_t width, height;
+    decoder.getSize(&width, &height);
+    worker->width = min((int)width - cropX, cropWidth);
+    worker->height = min((int)height - cropY, cropHeight);
+    if (worker->width <= 0 || worker->height <= 0) {
+      error = "crop is outside the GIF";
+    } else if (output == OUTPUT_RAW) {
+      std::string pathname = outputPathname(file, ".rgb");
+      if (makeParentDirectories(pathname))
+        raw = fopen(pathname.c_str(), "wb");
+      if (!raw)
+        error = "can't write the output";
+    }
+  }
+
+  if (!error && output == OUTPUT_THUMB) {
+    error = writeThumbnail(file);
+    frameCount = 1;
+    duration = decoder.getFrameDelay_ms();
+  } else if (!error) {
+    memset(worker->canvas, 0, sizeof(worker->canvas));
+    size_t frameBytes = (size_t)worker->width * worker->height * 3;
+    while ((result = decoder.decodeFrame(false)) == ERROR_NONE) {
+      duration += decoder.getFrameDelay_ms();
+      frameCount++;
+      if (raw) {
+        for (int y = 0; y < worker->height; y++)
+          fwrite(worker->canvas + y * BATCH_MAX_WIDTH * 3, 1,
+                 worker->width * 3, raw);
+      } else if (output == OUTPUT_SHEET &&
+                 worker->frames.size() + frameBytes <= SHEET_MAX_BYTES) {
+        for (int y = 0; y < worker->height; y++) {
+          const uint8_t *row = worker->canvas + y * BATCH_MAX_WIDTH * 3;
+          worker->frames.insert(worker->frames.end(), row,
+                                row + worker->width * 3);
+        }
+      }
+    }
+    if (result < 0 || frameCount == 0)
+      error = errorName(result);
+  }
+
+  if (raw && fclose(raw) != 0 && !error)
+    error = "can't write the output";
+  if (!error && output == OUTPUT_SHEET) {
+    if (worker->frames.size() < (size_t)frameCount * worker->width *
+                                    worker->height * 3)
+      error = "too many frames for a sprite sheet";
+    else if (!writeSheet(file, frameCount))
+      error = "can't write the output";
+  }
+
+  double ms = (micros() - start) / 1000.0;
+  std::string line = "{\"file\":";
+  appendJsonString(line, file.pathname.c_str());
+  char fields[256];
+  if (error) {
+    failures++;
+    line += ",\"status\":\"error\",\"error\":";
+    appendJsonString(line, error);
+    snprintf(fields, sizeof(fields), ",\"ms\":%.1f,\"worker\":%d}\n", ms,
+             worker->number);
+  } else {
+    snprintf(fields, sizeof(fields),
+             ",\"status\":\"ok\",\"width\":%d,\"height\":%d,\"frames\":%d,"
+             "\"duration_ms\":%lu,\"ms\":%.1f,\"worker\":%d}\n",
+             worker->width, worker->height, frameCount, duration, ms,
+             worker->number);
+  }
+  line += fields;
+  std::lock_guard<std::mutex> guard(reportLock);
+  fputs(line.c_str(), stdout);
+}
+
+static void runWorker(int n) {
+  worker = workers[n];
+  auto &decoder = worker->decoder;
+  decoder.setScreenClearCallback(screenClearCallback);
+  decoder.setDrawPixelCallback(drawPixelCallback);
+  decoder.setDrawSpanCallback(drawSpanCallback);
+  decoder.setSaveRectCallback(saveRectCallback);
+  decoder.setRestoreRectCallback(restoreRectCallback);
+  decoder.setFileSeekCallback(fileSeekCallback);
+  decoder.setFilePositionCallback(filePositionCallback);
+  decoder.setFileReadCallback(fileReadCallback);
+  decoder.setFileReadBlockCallback(fileReadBlockCallback);
+  decoder.setViewport(cropX, cropY, cropWidth, cropHeight);
+
+  int index;
+  while (pool->take(n, &index)) {
+    processFile(index);
+    pool->done();
+  }
+  free(fileData);
+}
+
+// Add the GIFs in a directory and the directories in it
+static void addDirectory(const std::string &directory,
+                         const std::string &relative) {
+  struct dirent **entries;
+  int n = scandir(directory.c_str(), &entries, NULL, alphasort);
+  if (n < 0)
+    return;
+  for (int i = 0; i < n; i++) {
+    const char *name = entries[i]->d_name;
+    std::string pathname = directory + "/" + name;
+    struct stat st;
+    if (name[0] != '.' && stat(pathname.c_str(), &st) == 0 &&
+        S_ISDIR(st.st_mode)) {
+      addDirectory(pathname, relative + name + "/");
+    } else if (isAnimationFile(name)) {
+      files.push_back({pathname, relative + name});
+    }
+    free(entries[i]);
+  }
+  free(entries);
+}
+
+int main(int argc, char **argv) {
+  int threads = std::thread::hardware_concurrency();
+  bool usage = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:f:o:s:c:")) != -1) {
+    switch (opt) {
+    case 'j':
+      threads = atoi(optarg);
+      break;
+    case 'f':
+      if (strcmp(optarg, "probe") == 0)
+        output = OUTPUT_PROBE;
+      else if (strcmp(optarg, "raw") == 0)
+        output = OUTPUT_RAW;
+      else if (strcmp(optarg, "sheet") == 0)
+        output = OUTPUT_SHEET;
+      else if (strcmp(optarg, "thumb") == 0)
+        output = OUTPUT_THUMB;
+      else
+        usage = true;
+      break;
+    case 'o':
+      outputDirectory = optarg;
+      break;
+    case 's':
+      thumbSize = atoi(optarg);
+      break;
+    case 'c':
+      crop = sscanf(optarg, "%d,%d,%d,%d", &cropX, &cropY, &cropWidth,
+                    &cropHeight) == 4;
+      usage |= !crop || cropX < 0 || cropY < 0 || cropWidth < 1 ||
+               cropHeight < 1;
+      break;
+    default:
+      usage = true;
+      break;
+    }
+  }
+  if (usage || optind >= argc || threads < 1 || thumbSize < 1 ||
+      (output != OUTPUT_PROBE && !outputDirectory)) {
+    fprintf(stderr,
+            "usage: %s [-j threads] [-f probe|raw|sheet|thumb] [-o outdir] "
+            "[-s size]\n"
+            "       [-c x,y,width,height] file.gif|directory...\n"
+            "  -j  worker threads (default one per core)\n"
+            "  -f  what to write for each GIF (default probe, nothing)\n"
+            "  -o  directory to write to, required unless -f probe\n"
+            "  -s  thumbnail size (default 64)\n"
+            "  -c  crop the GIFs to this rectangle\n",
+            argv[0]);
+    return 1;
+  }
+  if (!crop) {
+    cropWidth = BATCH_MAX_WIDTH;
+    cropHeight = BATCH_MAX_HEIGHT;
+  }
+
+  for (int i = optind; i < argc; i++) {
+    struct stat st;
+    if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+      addDirectory(argv[i], "");
+    } else {
+      const char *name = strrchr(argv[i], '/');
+      files.push_back({argv[i], name ? name + 1 : argv[i]});
+    }
+  }
+  threads = min(threads, std::max((int)files.size(), 1));
+
+  // Each worker starts with an even share of the files, in order
+  pool = new HostWorkerPool(threads);
+  for (int n = 0; n < threads; n++) {
+    workers.push_back(new Worker());
+    workers[n]->number = n;
+  }
+  for (size_t i = 0; i < files.size(); i++)
+    pool->push(i * threads / files.size(), i);
+
+  uint32_t start = micros();
+  pool->run(runWorker);
+  double seconds = (micros() - start) / 1e6;
+
+  fprintf(stderr, "%zu files, %d failed, %.2f s with %d threads\n",
+          files.size(), failures.load(), seconds, threads);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * Host benchmark for the GifDecoder library
+ *
+ * Decodes one full pass of each GIF with each of the output callbacks, and
+ * reports how many callbacks were needed per frame and the decode time, then
+ * where the time went in the line callback pass.
+ *
+ * Build and run from this directory:
+ *   c++ -O2 -I../../src -o gifbench GifBench.cpp
+ *   ./gifbench [-n passes] ../gifs
+ *
+ * -n decodes each GIF several times in each mode, for steadier timing
+ */
+
+#include "ArduinoShim.h"
+#include "HostFileFunctions.h"
+
+#include <unistd.h>
+
+// Time phases in nanoseconds, micros() is too coarse for per-line phases
+#define GIF_PROFILING
+#define GIF_PROFILE_CLOCK() hostNanos()
+#include <GifDecoder.h>
+
+#define BENCH_MAX_WIDTH 320
+#define BENCH_MAX_HEIGHT 320
+
+static GifDecoder<BENCH_MAX_WIDTH, BENCH_MAX_HEIGHT, 12> decoder;
+
+static unsigned long callbackCount;
+static unsigned long pixelCount;
+
+void drawPixelCallback(int16_t x, int16_t y, uint8_t red, uint8_t green,
+                       uint8_t blue) {
+  callbackCount++;
+  pixelCount++;
+}
+
+void drawLineCallback(int16_t x, int16_t y, uint8_t *buf, int16_t wid,
+                      uint16_t *palette565, int16_t skip) {
+  callbackCount++;
+  pixelCount += wid;
+}
+
+void drawSpanCallback(int16_t x, int16_t y, int16_t len, uint8_t red,
+                      uint8_t green, uint8_t blue) {
+  callbackCount++;
+  pixelCount += len;
+}
+
+enum { MODE_PIXEL, MODE_LINE, MODE_SPAN, MODE_COUNT };
+static const char *modeNames[MODE_COUNT] = {"pixel", "line", "span"};
+
+static int passes = 1;
+
+// Decode passes through the GIF, returns the number of frames
+static int decodePasses(void) {
+  int frames = 0;
+  decoder.startDecoding();
+  for (int pass = 0; pass < passes; pass++) {
+    while (decoder.decodeFrame(false) == 0)
+      frames++;
+  }
+  return frames;
+}
+
+static void printProfile(const char *name, const gif_profile &profile) {
+  printf("%-16s %-6s", name, "phases");
+  for (int i = 0; i < GIF_PHASE_COUNT; i++) {
+    printf(" %s:%.2f", decoder.getPhaseName(i),
+           (double)profile.phaseTime[i] / profile.frames / 1000);
+  }
+  printf(" (us/frame) bytes/frame:%.1f seeks/frame:%.1f\n",
+         (double)profile.bytesRead / profile.frames,
+         (double)profile.seeks / profile.frames);
+}
+
+static void benchmarkFile(const char *pathname) {
+  if (openGifFile(pathname) < 0) {
+    printf("%s: can't open\n", pathname);
+    return;
+  }
+
+  const char *name = strrchr(pathname, '/') ? strrchr(pathname, '/') + 1 : pathname;
+  for (int mode = 0; mode < MODE_COUNT; mode++) {
+    decoder.setDrawPixelCallback(mode == MODE_PIXEL ? drawPixelCallback : NULL);
+    decoder.setDrawLineCallback(mode == MODE_LINE ? drawLineCallback : NULL);
+    decoder.setDrawSpanCallback(mode == MODE_SPAN ? drawSpanCallback : NULL);
+    callbackCount = 0;
+    pixelCount = 0;
+
+    uint32_t start = micros();
+    int frames = decodePasses();
+    uint32_t elapsed = micros() - start;
+
+    if (frames == 0) {
+      printf("%-16s %-6s no frames decoded\n", name, modeNames[mode]);
+      continue;
+    }
+    printf("%-16s %-6s frames:%4d callbacks/frame:%8.1f pixels/frame:%8.1f "
+           "us/frame:%8.1f\n",
+           name, modeNames[mode], frames, (double)callbackCount / frames,
+           (double)pixelCount / frames, (double)elapsed / frames);
+    if (mode == MODE_LINE)
+      printProfile(name, decoder.getTotalProfile());
+  }
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+    case 'n':
+      passes = atoi(optarg);
+      break;
+    default:
+      optind = argc;
+      break;
+    }
+  }
+  if (optind >= argc || passes < 1) {
+    fprintf(stderr, "usage: %s [-n passes] file.gif|directory...\n", argv[0]);
+    return 1;
+  }
+
+  decoder.setFileSeekCallback(fileSeekCallback);
+  decoder.setFilePositionCallback(filePositionCallback);
+  decoder.setFileReadCallback(fileReadCallback);
+  decoder.setFileReadBlockCallback(fileReadBlockCallback);
+
+  forEachGifFile(argc - optind, argv + optind, benchmarkFile);
+  return 0;
+}
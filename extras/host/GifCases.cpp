@@ -0,0 +1,462 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * Checks the decoder on cases the GIFs in ../gifs don't cover, with small
+ * GIFs built in memory:
+ *  - color tables with more colors than the packed imageData canvas holds,
+ *    which have to be played with more bits per pixel or refused, never drawn
+ *    with the wrong colors
+ *  - a stall of seconds, after which playback carries on from the frame due
+ *    now without moving the timeline's epoch
+ *  - frame skipping, with frames dropped a little late and the frame times
+ *    skipped after a stall both counted, in GIFs and .fgf files
+ *  - duplicate frames in .fgf files
+ *  - extensions: skipped without seeking, and the NETSCAPE2.0 one given to
+ *    the metadata callback after its loop count is read
+ *  - the pixel and span callbacks given colors in the decoder's pixel format
+ *
+ * It's built with GIF_IMAGEDATA_BITS of 4, so imageData for the 32x32 decoder
+ * only holds 4 bits per pixel, and with HOST_MANUAL_CLOCK so the checks move
+ * micros() on themselves.  GifCheck.sh builds and runs it for each
+ * NO_IMAGEDATA mode, or from this directory:
+ *   c++ -O2 -DNO_IMAGEDATA=0 -I../../src -o gifcases0 GifCases.cpp
+ *   ./gifcases0
+ * The exit status is 1 if anything failed.
+ */
+
+#define GIF_IMAGEDATA_BITS 4
+#define HOST_MANUAL_CLOCK
+
+#include "ArduinoShim.h"
+#include "HostFileFunctions.h"
+#include "HostLzwEncoder.h"
+
+#include <GifDecoder.h>
+
+#define CASES_MAX_WIDTH 32
+#define CASES_MAX_HEIGHT 32
+
+static GifDecoder<CASES_MAX_WIDTH, CASES_MAX_HEIGHT, 12> decoder;
+static GifDecoder<CASES_MAX_WIDTH, CASES_MAX_HEIGHT, 12, GIF_PIXEL_RGB888>
+    decoder888;
+
+static uint8_t canvas[CASES_MAX_WIDTH * CASES_MAX_HEIGHT * 3];
+
+static int failures;
+
+static void screenClearCallback(void) { memset(canvas, 0, sizeof(canvas)); }
+
+static void drawPixelCallback(int16_t x, int16_t y, uint8_t red, uint8_t green,
+                              uint8_t blue) {
+  if (x < 0 || y < 0 || x >= CASES_MAX_WIDTH || y >= CASES_MAX_HEIGHT)
+    return;
+  uint8_t *p = canvas + (y * CASES_MAX_WIDTH + x) * 3;
+  p[0] = red;
+  p[1] = green;
+  p[2] = blue;
+}
+
+static void drawPixel888Callback(int16_t x, int16_t y, uint32_t color) {
+  drawPixelCallback(x, y, color >> 16, color >> 8, color);
+}
+
+static void drawSpan888Callback(int16_t x, int16_t y, int16_t len,
+                                uint32_t color) {
+  for (int i = 0; i < len; i++)
+    drawPixel888Callback(x + i, y, color);
+}
+
+static void check(bool ok, const char *name) {
+  printf("%s: %s\n", name, ok ? "ok" : "FAIL");
+  failures += !ok;
+}
+
+// The GIF is built in memory and decoded from there
+static uint8_t *gif;
+static unsigned long gifSize;
+static unsigned long gifCapacity;
+
+static void put(const void *data, unsigned long len) {
+  if (gifSize + len > gifCapacity) {
+    gifCapacity = (gifSize + len) * 2;
+    gif = (uint8_t *)realloc(gif, gifCapacity);
+  }
+  memcpy(gif + gifSize, data, len);
+  gifSize += len;
+}
+
+static void putByte(uint8_t b) { put(&b, 1); }
+
+static void putWord(uint16_t w) {
+  putByte(w & 0xff);
+  putByte(w >> 8);
+}
+
+// Color i of the test GIFs' tables
+static void tableColor(int i, uint8_t *rgb) {
+  rgb[0] = i;
+  rgb[1] = 255 - i;
+  rgb[2] = i * 7;
+}
+
+// The palette index of a pixel of a frame, using every color in the table
+static uint8_t framePixel(int x, int y, int frame, int colors) {
+  return (x + y * 5 + frame) % colors;
+}
+
+// Start a GIF with a global color table of 2^colorBits colors
+static void beginGif(int width, int height, int colorBits) {
+  gifSize = 0;
+  put("GIF89a", 6);
+  putWord(width);
+  putWord(height);
+  putByte(0x80 | 0x70 | (colorBits - 1));
+  putByte(0); // background
+  putByte(0); // aspect ratio
+  for (int i = 0; i < (1 << colorBits); i++) {
+    uint8_t rgb[3];
+    tableColor(i, rgb);
+    put(rgb, 3);
+  }
+}
+
+// An opaque frame covering the whole GIF, left in place
+static void putFrame(int width, int height, int colorBits, int frame,
+                     int delay) {
+  putByte(0x21);
+  putByte(0xf9);
+  putByte(4);
+  putByte(1 << 2);
+  putWord(delay);
+  putByte(0);
+  putByte(0);
+
+  putByte(0x2c);
+  putWord(0);
+  putWord(0);
+  putWord(width);
+  putWord(height);
+  putByte(0);
+  uint8_t pixels[CASES_MAX_WIDTH * CASES_MAX_HEIGHT];
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++)
+      pixels[y * width + x] = framePixel(x, y, frame, 1 << colorBits);
+  }
+  lzwEncode(pixels, width * height, colorBits < 2 ? 2 : colorBits, 12);
+  put(lzwData, lzwDataSize);
+}
+
+// A NETSCAPE2.0 extension with a loop count
+static void putLoopCount(int loops) {
+  put("\x21\xff\x0bNETSCAPE2.0\x03\x01", 16);
+  putWord(loops);
+  putByte(0);
+}
+
+// A comment extension of blocks sub-blocks
+static void putComment(int blocks) {
+  putByte(0x21);
+  putByte(0xfe);
+  for (int i = 0; i < blocks; i++) {
+    putByte(200);
+    for (int j = 0; j < 200; j++)
+      putByte('a' + j % 26);
+  }
+  putByte(0);
+}
+
+static void endGif(void) {
+  putByte(0x3b);
+  fileData = gif;
+  fileSize = gifSize;
+  filePosition = 0;
+}
+
+// A .fgf file of 32x32 frames with 16 colors stored raw, except blankFrame,
+// which draws nothing like GifTranscode writes for a frame that's the same as
+// the one before
+static void makeFastGif(int frames, int blankFrame, int delay) {
+  gifSize = 0;
+  put("FGIF", 4);
+  putByte(1); // version
+  putByte(0); // not aligned
+  putWord(32);
+  putWord(32);
+  putWord(frames);
+  putWord(0); // loop forever
+  putWord(0);
+  for (int frame = 0; frame < frames; frame++) {
+    int size = (frame == blankFrame) ? 0 : 32;
+    int colors = (frame == 0) ? 16 : 0;
+    putWord(20 + colors * 3 + size * size);
+    putWord(0);
+    putByte(0); // flags
+    putByte(0); // transparent index
+    putWord(delay);
+    putWord(0);
+    putWord(0);
+    putWord(size);
+    putWord(size);
+    putWord(colors);
+    putWord(0);
+    for (int i = 0; i < colors; i++) {
+      uint8_t rgb[3];
+      tableColor(i, rgb);
+      put(rgb, 3);
+    }
+    for (int y = 0; y < size; y++) {
+      for (int x = 0; x < size; x++)
+        putByte(framePixel(x, y, frame, 16));
+    }
+  }
+  fileData = gif;
+  fileSize = gifSize;
+  filePosition = 0;
+}
+
+static void startDecoder(void) {
+  decoder.setScreenClearCallback(screenClearCallback);
+  decoder.setFileSeekCallback(fileSeekCallback);
+  decoder.setFilePositionCallback(filePositionCallback);
+  decoder.setFileReadCallback(fileReadCallback);
+  decoder.setFileReadBlockCallback(fileReadBlockCallback);
+  decoder.setDrawPixelCallback(drawPixelCallback);
+  memset(canvas, 0, sizeof(canvas));
+  filePosition = 0;
+  decoder.startDecoding();
+}
+
+// Whether the canvas shows the viewport of a frame with the right colors
+static bool canvasShowsFrame(int viewportX, int viewportY, int width,
+                             int height, int colorBits, int frame) {
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      uint8_t rgb[3];
+      tableColor(framePixel(viewportX + x, viewportY + y, frame,
+                            1 << colorBits),
+                 rgb);
+      if (memcmp(canvas + (y * CASES_MAX_WIDTH + x) * 3, rgb, 3) != 0)
+        return false;
+    }
+  }
+  return true;
+}
+
+// A 32x32 canvas only fits in imageData with 4 bits per pixel: a 16 color
+// GIF plays, a 256 color one is refused.  A 16x16 viewport of it fits with 8
+// bits and plays.  Drawing a line at a time there's no imageData, so every
+// GIF plays
+static void checkColorTables(void) {
+  beginGif(32, 32, 4);
+  putFrame(32, 32, 4, 0, 10);
+  putFrame(32, 32, 4, 1, 10);
+  endGif();
+  startDecoder();
+  bool ok = decoder.decodeFrame(false) == ERROR_NONE &&
+            canvasShowsFrame(0, 0, 32, 32, 4, 0) &&
+            decoder.decodeFrame(false) == ERROR_NONE &&
+            canvasShowsFrame(0, 0, 32, 32, 4, 1);
+  check(ok, "16 colors, 32x32");
+
+  beginGif(32, 32, 8);
+  putFrame(32, 32, 8, 0, 10);
+  putFrame(32, 32, 8, 1, 10);
+  endGif();
+  startDecoder();
+#if NO_IMAGEDATA < 2
+  check(decoder.decodeFrame(false) == ERROR_TOOMANYCOLORS,
+        "256 colors, 32x32 refused");
+#else
+  ok = decoder.decodeFrame(false) == ERROR_NONE &&
+       canvasShowsFrame(0, 0, 32, 32, 8, 0) &&
+       decoder.decodeFrame(false) == ERROR_NONE &&
+       canvasShowsFrame(0, 0, 32, 32, 8, 1);
+  check(ok, "256 colors, 32x32");
+#endif
+
+  startDecoder();
+  decoder.setViewport(8, 4, 16, 16);
+  ok = decoder.decodeFrame(false) == ERROR_NONE &&
+       canvasShowsFrame(8, 4, 16, 16, 8, 0) &&
+       decoder.decodeFrame(false) == ERROR_NONE &&
+       canvasShowsFrame(8, 4, 16, 16, 8, 1);
+  check(ok, "256 colors, 16x16 viewport");
+  decoder.setViewport(0, 0, CASES_MAX_WIDTH, CASES_MAX_HEIGHT);
+}
+
+// Decode the next frame and present it when it's due, moving the clock on a
+// millisecond at a time while it's waiting
+static int stepFrame(void) {
+  int result;
+  while ((result = decoder.decodeStep(0, true)) == ERROR_WAITING)
+    hostMicros += 1000;
+  return result;
+}
+
+// Frames of 100ms, played from an epoch set by the caller.  After a 5.05
+// second stall the next frame is shown straight away, and the timeline is
+// moved on by whole frame delays so the frame after is due on the same
+// 100ms steps from the epoch, within 100ms of now
+static void checkStall(void) {
+  beginGif(32, 32, 4);
+  for (int frame = 0; frame < 4; frame++)
+    putFrame(32, 32, 4, frame, 10);
+  endGif();
+  hostMicros = 1000000;
+  startDecoder();
+  uint32_t epoch = hostMicros + 20000;
+  decoder.setTimelineEpoch(epoch);
+  bool ok = stepFrame() == ERROR_NONE && hostMicros == epoch;
+
+  hostMicros += 5050000;
+  uint32_t stalled = hostMicros;
+  ok = ok && stepFrame() == ERROR_NONE && hostMicros == stalled;
+  uint32_t next = decoder.getNextPresentationTime();
+  ok = ok && decoder.getTimelineEpoch() == epoch &&
+       (next - epoch) % 100000 == 0 && (int32_t)(next - hostMicros) > 0 &&
+       next - hostMicros <= 100000;
+  check(ok, "stall keeps the epoch");
+}
+
+// With frame skipping, 350ms late on frames of 100ms the next two are
+// dropped and the third drawn.  After a 5.05 second stall 50 frame times are
+// skipped, and counted as dropped too.  The same for a .fgf file
+static void checkFrameSkipping(bool fast) {
+  if (fast) {
+    makeFastGif(8, -1, 10);
+  } else {
+    beginGif(32, 32, 4);
+    for (int frame = 0; frame < 8; frame++)
+      putFrame(32, 32, 4, frame, 10);
+    endGif();
+  }
+  hostMicros = 1000000;
+  startDecoder();
+  decoder.setFrameSkipping(true);
+  uint32_t epoch = hostMicros;
+  bool ok = stepFrame() == ERROR_NONE;
+
+  hostMicros = epoch + 350000;
+  for (int i = 0; i < 3; i++)
+    ok = ok && stepFrame() == ERROR_NONE;
+  ok = ok && decoder.isFastFormat() == fast &&
+       decoder.getDroppedFrames() == 2 &&
+       canvasShowsFrame(0, 0, 32, 32, 4, 3);
+  check(ok, fast ? ".fgf frames dropped when late" : "frames dropped when late");
+
+  hostMicros = epoch + 5450000;
+  ok = stepFrame() == ERROR_NONE && decoder.getDroppedFrames() == 52 &&
+       canvasShowsFrame(0, 0, 32, 32, 4, 4);
+  check(ok, fast ? ".fgf frame times skipped after a stall counted"
+                 : "frame times skipped after a stall counted");
+  decoder.setFrameSkipping(false);
+}
+
+// The sub-blocks the metadata callback was given for the NETSCAPE2.0
+// extension, with the loop count when it was given each
+static int metadataBlocks;
+static int metadataLoopCounts[4];
+static bool metadataIdentified;
+
+static bool metadataCallback(uint8_t label, int index, const uint8_t *data,
+                             int len) {
+  if (label != 0xff || metadataBlocks >= 4)
+    return false;
+  if (index == 0)
+    metadataIdentified = len == 11 && memcmp(data, "NETSCAPE2.0", 11) == 0;
+  metadataLoopCounts[metadataBlocks++] = decoder.getLoopCount();
+  return true;
+}
+
+// A comment of 10 sub-blocks before the first frame is skipped without any
+// more seeks than the GIF without it.  The NETSCAPE2.0 extension goes to the
+// metadata callback, its loop count sub-block after the count is read
+static void checkExtensions(void) {
+  beginGif(32, 32, 4);
+  putFrame(32, 32, 4, 0, 10);
+  endGif();
+  startDecoder();
+  unsigned long seeksBefore = fileSeeks;
+  decoder.decodeFrame(false);
+  unsigned long seeks = fileSeeks - seeksBefore;
+
+  beginGif(32, 32, 4);
+  putComment(10);
+  putFrame(32, 32, 4, 0, 10);
+  endGif();
+  startDecoder();
+  seeksBefore = fileSeeks;
+  bool ok = decoder.decodeFrame(false) == ERROR_NONE &&
+            fileSeeks - seeksBefore == seeks &&
+            canvasShowsFrame(0, 0, 32, 32, 4, 0);
+  check(ok, "comment skipped without seeking");
+
+  beginGif(32, 32, 4);
+  putLoopCount(3);
+  putFrame(32, 32, 4, 0, 10);
+  endGif();
+  metadataBlocks = 0;
+  decoder.setMetadataCallback(metadataCallback);
+  startDecoder();
+  ok = decoder.decodeFrame(false) == ERROR_NONE && metadataIdentified &&
+       metadataBlocks == 2 && metadataLoopCounts[1] == 3 &&
+       decoder.getLoopCount() == 3;
+  check(ok, "NETSCAPE2.0 given to the metadata callback");
+  decoder.setMetadataCallback(NULL);
+}
+
+// A .fgf frame that draws nothing is a duplicate of the one before
+static void checkFastDuplicates(void) {
+  makeFastGif(4, 2, 10);
+  startDecoder();
+  decoder.setDuplicateFrameSkipping(true);
+  bool ok = true;
+  for (int i = 0; i < 3; i++)
+    ok = ok && decoder.decodeFrame(false) == ERROR_NONE;
+  ok = ok && decoder.getDuplicateFrames() == 1 &&
+       canvasShowsFrame(0, 0, 32, 32, 4, 1);
+  check(ok, ".fgf duplicate frames");
+  decoder.setDuplicateFrameSkipping(false);
+}
+
+// A GIF_PIXEL_RGB888 decoder gives the pixel and span format callbacks the
+// same colors as the RGB ones
+static void checkPixelFormatCallbacks(void) {
+  beginGif(32, 32, 8);
+  putFrame(32, 32, 8, 0, 10);
+  endGif();
+  decoder888.setFileSeekCallback(fileSeekCallback);
+  decoder888.setFilePositionCallback(filePositionCallback);
+  decoder888.setFileReadCallback(fileReadCallback);
+  decoder888.setFileReadBlockCallback(fileReadBlockCallback);
+  // 256 colors fit the 4-bit imageData with a 16x16 viewport
+  decoder888.setViewport(0, 0, 16, 16);
+
+  decoder888.setDrawPixelFormatCallback(drawPixel888Callback);
+  memset(canvas, 0, sizeof(canvas));
+  filePosition = 0;
+  decoder888.startDecoding();
+  check(decoder888.decodeFrame(false) == ERROR_NONE &&
+            canvasShowsFrame(0, 0, 16, 16, 8, 0),
+        "pixel format callback");
+
+  decoder888.setDrawSpanFormatCallback(drawSpan888Callback);
+  memset(canvas, 0, sizeof(canvas));
+  filePosition = 0;
+  decoder888.startDecoding();
+  check(decoder888.decodeFrame(false) == ERROR_NONE &&
+            canvasShowsFrame(0, 0, 16, 16, 8, 0),
+        "span format callback");
+}
+
+int main(int argc, char **argv) {
+  checkColorTables();
+  checkStall();
+  checkFrameSkipping(false);
+  checkFrameSkipping(true);
+  checkFastDuplicates();
+  checkExtensions();
+  checkPixelFormatCallbacks();
+  printf("NO_IMAGEDATA=%d %s\n", NO_IMAGEDATA, failures ? "FAILED" : "passed");
+  return failures ? 1 : 0;
+}
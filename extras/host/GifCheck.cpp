@@ -0,0 +1,438 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * Checks that a change to the decoder keeps its output the same and doesn't
+ * make it slower.  Each GIF is decoded with lzwMaxBits of 10, 11 and 12,
+ * drawing into a canvas with the pixel callback, and every frame of the
+ * canvas goes into a CRC.
+ *
+ * The CRCs are compared with the golden file, GifCheck.golden or -g, which
+ * holds each GIF's output decoded with lzwMaxBits of 12, and the smallest
+ * lzwMaxBits that decodes it the same.  A decoder with at least that many
+ * bits has to match; GIFs that need more than a decoder has are skipped, as
+ * they can't be decoded right with it.  -u writes the golden file instead,
+ * replacing the lines for the NO_IMAGEDATA mode the tool was built with, for
+ * when a change is meant to alter the output.
+ *
+ * Each GIF is then decoded again with a line callback that draws nothing, in
+ * three rounds of the fastest of -n passes (more for small GIFs).  Each round
+ * is taken relative to a CRC loop timed just before it, and the fastest round
+ * is the decode time, so the baseline, GifCheck.baseline or -b, carries over
+ * from one machine to another.  If the mean (geometric) of the times for the
+ * build's mode is more than -p percent (25 by default) slower than the
+ * baseline the check fails; GIFs slower than that on their own are only
+ * listed, as one time can be off by that much on a busy machine.  -w writes
+ * the baseline instead, and -o checks the output without timing it.  The exit
+ * status is 1 if anything failed.
+ *
+ * GifCheck.sh builds the tool (and GifCases) for each NO_IMAGEDATA mode and
+ * runs it on ../gifs, passing its options on:
+ *   ./GifCheck.sh            check everything
+ *   ./GifCheck.sh -u -w      write the golden CRCs and the baseline
+ * or build and run one mode by hand from this directory:
+ *   c++ -O2 -DNO_IMAGEDATA=0 -I../../src -o gifcheck0 GifCheck.cpp
+ *   ./gifcheck0 ../gifs
+ */
+
+#include "ArduinoShim.h"
+#include "HostFileFunctions.h"
+
+#include <math.h>
+#include <unistd.h>
+
+#include <GifDecoder.h>
+
+#define CHECK_MAX_WIDTH 320
+#define CHECK_MAX_HEIGHT 320
+
+// Small GIFs are timed for more passes, until they've taken this long
+#define MIN_TIMING_NANOS 50000000
+#define TIMING_ROUNDS 3
+
+// The calibration loop's data, and how long it's timed for
+#define CALIBRATION_SIZE 16384
+#define CALIBRATION_NANOS 20000000
+
+#define BASELINE_MAX_LINES 1024
+#define BASELINE_LINE_SIZE 256
+
+static GifDecoder<CHECK_MAX_WIDTH, CHECK_MAX_HEIGHT, 10> decoder10;
+static GifDecoder<CHECK_MAX_WIDTH, CHECK_MAX_HEIGHT, 11> decoder11;
+static GifDecoder<CHECK_MAX_WIDTH, CHECK_MAX_HEIGHT, 12> decoder12;
+
+static uint8_t canvas[CHECK_MAX_WIDTH * CHECK_MAX_HEIGHT * 3];
+
+static void screenClearCallback(void) { memset(canvas, 0, sizeof(canvas)); }
+
+static void drawPixelCallback(int16_t x, int16_t y, uint8_t red, uint8_t green,
+                              uint8_t blue) {
+  if (x < 0 || y < 0 || x >= CHECK_MAX_WIDTH || y >= CHECK_MAX_HEIGHT)
+    return;
+  uint8_t *p = canvas + (y * CHECK_MAX_WIDTH + x) * 3;
+  p[0] = red;
+  p[1] = green;
+  p[2] = blue;
+}
+
+static void drawLineCallback(int16_t x, int16_t y, uint8_t *buf, int16_t wid,
+                             uint16_t *palette565, int16_t skip) {}
+
+static uint32_t crcTable[256];
+
+static void initCrc(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++)
+      c = (c >> 1) ^ (0xEDB88320 & -(c & 1));
+    crcTable[i] = c;
+  }
+}
+
+// Continue a CRC-32 with len more bytes
+static uint32_t crc32(uint32_t crc, const uint8_t *data, unsigned long len) {
+  crc = ~crc;
+  for (unsigned long i = 0; i < len; i++)
+    crc = crcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+// A golden or baseline file, one line per NO_IMAGEDATA mode, GIF and for the
+// baseline lzwMaxBits, and the new lines to write to it
+struct ResultsFile {
+  const char *pathname;
+  bool write;
+  char lines[BASELINE_MAX_LINES][BASELINE_LINE_SIZE];
+  int count;
+  char results[BASELINE_MAX_LINES][BASELINE_LINE_SIZE];
+  int resultCount;
+};
+
+static ResultsFile golden = {"GifCheck.golden"};
+static ResultsFile baseline = {"GifCheck.baseline"};
+
+static bool timing = true;
+static int passes = 5;
+static double slowerPercent = 25;
+static int failures;
+
+// Nanoseconds for the calibration loop, which times are relative to
+static double calibrationNanos;
+// Sum of the logs of each time relative to the baseline, for the mean
+static double slowdownLogs;
+static int slowdownCount;
+
+static bool readResults(ResultsFile &file) {
+  FILE *f = fopen(file.pathname, "r");
+  if (!f)
+    return false;
+  while (file.count < BASELINE_MAX_LINES &&
+         fgets(file.lines[file.count], BASELINE_LINE_SIZE, f)) {
+    file.lines[file.count][strcspn(file.lines[file.count], "\n")] = 0;
+    file.count++;
+  }
+  fclose(f);
+  return true;
+}
+
+static void addResult(ResultsFile &file, const char *line) {
+  if (file.resultCount < BASELINE_MAX_LINES)
+    snprintf(file.results[file.resultCount++], BASELINE_LINE_SIZE, "%s", line);
+}
+
+// Write the file back with the lines for this build's mode replaced by the
+// new results
+static void saveResults(ResultsFile &file) {
+  char mode[32];
+  snprintf(mode, sizeof(mode), "NO_IMAGEDATA=%d ", NO_IMAGEDATA);
+  FILE *f = fopen(file.pathname, "w");
+  if (!f) {
+    perror(file.pathname);
+    failures++;
+    return;
+  }
+  for (int i = 0; i < file.count; i++) {
+    if (strncmp(file.lines[i], mode, strlen(mode)) != 0)
+      fprintf(f, "%s\n", file.lines[i]);
+  }
+  for (int i = 0; i < file.resultCount; i++)
+    fprintf(f, "%s\n", file.results[i]);
+  fclose(f);
+}
+
+// The rest of the line for the key, or NULL
+static const char *findResult(const ResultsFile &file, const char *key) {
+  for (int i = 0; i < file.count; i++) {
+    if (strncmp(file.lines[i], key, strlen(key)) == 0 &&
+        file.lines[i][strlen(key)] == ' ')
+      return file.lines[i] + strlen(key);
+  }
+  return NULL;
+}
+
+// The fastest of passes over a CRC of a buffer, in nanoseconds: a stand-in
+// for the table lookups of decoding that takes as long on a given machine
+// every time
+static void calibrate(void) {
+  static uint8_t data[CALIBRATION_SIZE];
+  uint32_t seed = 1;
+  for (int i = 0; i < CALIBRATION_SIZE; i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = seed >> 24;
+  }
+  uint32_t best = 0;
+  uint64_t total = 0;
+  volatile uint32_t sink;
+  for (int pass = 0; total < CALIBRATION_NANOS; pass++) {
+    uint32_t start = hostNanos();
+    sink = crc32(0, data, sizeof(data));
+    uint32_t elapsed = hostNanos() - start;
+    if (pass == 0 || elapsed < best)
+      best = elapsed;
+    total += elapsed;
+  }
+  (void)sink;
+  calibrationNanos = best;
+}
+
+// The canvas CRC of every frame, false if the GIF can't be decoded
+template <int lzwMaxBits>
+static bool decodeOutput(
+    GifDecoder<CHECK_MAX_WIDTH, CHECK_MAX_HEIGHT, lzwMaxBits> &decoder,
+    int *frames, uint32_t *crc) {
+  decoder.setScreenClearCallback(screenClearCallback);
+  decoder.setFileSeekCallback(fileSeekCallback);
+  decoder.setFilePositionCallback(filePositionCallback);
+  decoder.setFileReadCallback(fileReadCallback);
+  decoder.setFileReadBlockCallback(fileReadBlockCallback);
+  decoder.setDrawPixelCallback(drawPixelCallback);
+  decoder.setDrawLineCallback(NULL);
+  memset(canvas, 0, sizeof(canvas));
+  filePosition = 0;
+  if (decoder.startDecoding() < 0)
+    return false;
+  uint16_t width, height;
+  decoder.getSize(&width, &height);
+  width = min(width, CHECK_MAX_WIDTH);
+  height = min(height, CHECK_MAX_HEIGHT);
+  *frames = 0;
+  *crc = 0;
+  while (decoder.decodeFrame(false) == ERROR_NONE) {
+    for (int y = 0; y < height; y++)
+      *crc = crc32(*crc, canvas + y * CHECK_MAX_WIDTH * 3, width * 3);
+    (*frames)++;
+  }
+  return true;
+}
+
+// The fastest decode of passes, drawing nothing, in nanoseconds
+template <int lzwMaxBits>
+static uint32_t timeDecoding(
+    GifDecoder<CHECK_MAX_WIDTH, CHECK_MAX_HEIGHT, lzwMaxBits> &decoder) {
+  decoder.setDrawPixelCallback(NULL);
+  decoder.setDrawLineCallback(drawLineCallback);
+  uint32_t best = 0;
+  uint64_t total = 0;
+  for (int pass = 0; pass < passes || total < MIN_TIMING_NANOS; pass++) {
+    filePosition = 0;
+    uint32_t start = hostNanos();
+    decoder.startDecoding();
+    while (decoder.decodeFrame(false) == ERROR_NONE)
+      ;
+    uint32_t elapsed = hostNanos() - start;
+    if (pass == 0 || elapsed < best)
+      best = elapsed;
+    total += elapsed;
+  }
+  return best;
+}
+
+// Time the decoder and compare it with the baseline, or add it to it
+template <int lzwMaxBits>
+static void checkTime(
+    GifDecoder<CHECK_MAX_WIDTH, CHECK_MAX_HEIGHT, lzwMaxBits> &decoder,
+    const char *name, int frames) {
+  // Calibrated again each time, so the machine slowing down or speeding up
+  // while the check runs doesn't count against the decoder
+  uint32_t best = 0;
+  for (int i = 0; i < TIMING_ROUNDS; i++) {
+    calibrate();
+    uint32_t t = timeDecoding(decoder);
+    if (i == 0 || t < best)
+      best = t;
+  }
+  double nanosPerFrame = (double)best / frames;
+  double units = nanosPerFrame / calibrationNanos;
+
+  char key[BASELINE_LINE_SIZE / 2];
+  snprintf(key, sizeof(key), "NO_IMAGEDATA=%d lzwMaxBits=%d %s", NO_IMAGEDATA,
+           lzwMaxBits, name);
+  if (baseline.write) {
+    char line[BASELINE_LINE_SIZE];
+    snprintf(line, sizeof(line), "%s units/frame=%.4f", key, units);
+    addResult(baseline, line);
+    printf("%s units/frame=%.4f (%.1f us/frame)\n", key, units,
+           nanosPerFrame / 1000);
+    return;
+  }
+
+  const char *line = findResult(baseline, key);
+  double baseUnits;
+  if (!line || sscanf(line, " units/frame=%lf", &baseUnits) != 1 ||
+      baseUnits <= 0) {
+    printf("%s FAIL: not in %s\n", key, baseline.pathname);
+    failures++;
+    return;
+  }
+  double ratio = units / baseUnits;
+  slowdownLogs += log(ratio);
+  slowdownCount++;
+  printf("%s %s: %.1f us/frame, %+.0f%% on the baseline\n", key,
+         ratio > 1 + slowerPercent / 100 ? "slower" : "time",
+         nanosPerFrame / 1000, (ratio - 1) * 100);
+}
+
+// Compare one decoder's output with the golden CRC, unless the GIF needs more
+// lzwMaxBits than it has
+static void compareOutput(const char *name, int lzwMaxBits, int frames,
+                          uint32_t crc) {
+  char key[BASELINE_LINE_SIZE / 2];
+  snprintf(key, sizeof(key), "NO_IMAGEDATA=%d %s", NO_IMAGEDATA, name);
+  const char *line = findResult(golden, key);
+  int goldenFrames, goldenBits;
+  unsigned int goldenCrc;
+  if (!line || sscanf(line, " frames=%d crc=%x lzwMaxBits=%d", &goldenFrames,
+                      &goldenCrc, &goldenBits) != 3) {
+    printf("%s lzwMaxBits=%d FAIL: not in %s\n", key, lzwMaxBits,
+           golden.pathname);
+    failures++;
+  } else if (lzwMaxBits < goldenBits) {
+    printf("%s lzwMaxBits=%d skipped: needs lzwMaxBits=%d\n", key, lzwMaxBits,
+           goldenBits);
+  } else if (goldenFrames != frames || goldenCrc != crc) {
+    printf("%s lzwMaxBits=%d FAIL: output changed, frames=%d crc=%08x, was "
+           "frames=%d crc=%08x\n",
+           key, lzwMaxBits, frames, (unsigned)crc, goldenFrames, goldenCrc);
+    failures++;
+  } else {
+    printf("%s lzwMaxBits=%d ok: frames=%d crc=%08x\n", key, lzwMaxBits,
+           frames, (unsigned)crc);
+  }
+}
+
+static void checkGif(const char *pathname) {
+  int len = strlen(pathname);
+  if (len > 4 && strcasecmp(pathname + len - 4, ".fgf") == 0)
+    return;
+  if (openGifFile(pathname) < 0) {
+    perror(pathname);
+    failures++;
+    return;
+  }
+  const char *name =
+      strrchr(pathname, '/') ? strrchr(pathname, '/') + 1 : pathname;
+
+  int frames[3];
+  uint32_t crcs[3];
+  if (!decodeOutput(decoder10, &frames[0], &crcs[0]) ||
+      !decodeOutput(decoder11, &frames[1], &crcs[1]) ||
+      !decodeOutput(decoder12, &frames[2], &crcs[2])) {
+    printf("%s: can't decode\n", name);
+    failures++;
+    return;
+  }
+
+  if (golden.write) {
+    // lzwMaxBits of 12 decodes any GIF, fewer bits only decode some the same
+    int bits = 12;
+    while (bits > 10 && frames[bits - 11] == frames[2] &&
+           crcs[bits - 11] == crcs[2])
+      bits--;
+    char line[BASELINE_LINE_SIZE];
+    snprintf(line, sizeof(line),
+             "NO_IMAGEDATA=%d %s frames=%d crc=%08x lzwMaxBits=%d",
+             NO_IMAGEDATA, name, frames[2], (unsigned)crcs[2], bits);
+    addResult(golden, line);
+    printf("%s\n", line);
+  } else {
+    for (int i = 0; i < 3; i++)
+      compareOutput(name, 10 + i, frames[i], crcs[i]);
+  }
+
+  if (!timing || !frames[2])
+    return;
+  checkTime(decoder10, name, frames[0]);
+  checkTime(decoder11, name, frames[1]);
+  checkTime(decoder12, name, frames[2]);
+}
+
+int main(int argc, char **argv) {
+  bool usage = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "g:ub:wn:p:o")) != -1) {
+    switch (opt) {
+    case 'g':
+      golden.pathname = optarg;
+      break;
+    case 'u':
+      golden.write = true;
+      break;
+    case 'b':
+      baseline.pathname = optarg;
+      break;
+    case 'w':
+      baseline.write = true;
+      break;
+    case 'n':
+      passes = atoi(optarg);
+      break;
+    case 'p':
+      slowerPercent = atof(optarg);
+      break;
+    case 'o':
+      timing = false;
+      break;
+    default:
+      usage = true;
+      break;
+    }
+  }
+  if (usage || optind >= argc || passes < 1 || (baseline.write && !timing)) {
+    fprintf(stderr,
+            "usage: %s [-g golden] [-u] [-b baseline] [-w] [-n passes] "
+            "[-p percent] [-o] file.gif|directory...\n"
+            "  -g  golden CRCs to compare with (default GifCheck.golden)\n"
+            "  -u  write the CRCs to the golden file instead\n"
+            "  -b  decode times to compare with (default GifCheck.baseline)\n"
+            "  -w  write the decode times to the baseline file instead\n"
+            "  -n  passes to time, the fastest counts (default 5)\n"
+            "  -p  fail when this much slower on average (default 25)\n"
+            "  -o  only check the output, don't time it\n",
+            argv[0]);
+    return 1;
+  }
+
+  initCrc();
+  if (!readResults(golden) && !golden.write) {
+    fprintf(stderr, "%s: no golden CRCs\n", golden.pathname);
+    return 1;
+  }
+  if (timing && !readResults(baseline) && !baseline.write) {
+    fprintf(stderr, "%s: no baseline\n", baseline.pathname);
+    return 1;
+  }
+  forEachGifFile(argc - optind, argv + optind, checkGif);
+  if (golden.write)
+    saveResults(golden);
+  if (baseline.write)
+    saveResults(baseline);
+  if (slowdownCount) {
+    double mean = exp(slowdownLogs / slowdownCount);
+    bool slower = mean > 1 + slowerPercent / 100;
+    printf("NO_IMAGEDATA=%d %s: %+.0f%% on the baseline on average\n",
+           NO_IMAGEDATA, slower ? "FAIL" : "time", (mean - 1) * 100);
+    failures += slower;
+  }
+  if (!golden.write || (timing && !baseline.write))
+    printf("%s\n", failures ? "FAILED" : "passed");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,19 @@
+#!/bin/sh
+#
+# Builds GifCheck and GifCases for each NO_IMAGEDATA mode and runs them,
+# GifCheck on the GIFs in ../gifs, passing any options on to it, e.g. -u -w to
+# write the golden CRCs and the baseline.  The exit status is 1 if any mode
+# failed.
+
+cd "$(dirname "$0")" || exit 1
+build=${TMPDIR:-/tmp}
+status=0
+for mode in 0 1 2; do
+  c++ -O2 -Wall -DNO_IMAGEDATA=$mode -I../../src -o "$build/gifcheck$mode" \
+      GifCheck.cpp || exit 1
+  c++ -O2 -Wall -DNO_IMAGEDATA=$mode -I../../src -o "$build/gifcases$mode" \
+      GifCases.cpp || exit 1
+  "$build/gifcheck$mode" "$@" ../gifs || status=1
+  "$build/gifcases$mode" || status=1
+done
+exit $status
@@ -0,0 +1,212 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * Plays many GIFs at once on a few threads with the frame generator in
+ * HostGifFrames.h, like a preview server would.  Each GIF given is a
+ * generator, and the -j workers of the pool in HostWorkerPool.h (the one
+ * GifBatch decodes on) play a frame of one at a time.  After each frame the
+ * GIF is queued for the next worker, so generators move from thread to thread
+ * between frames.  -r waits for each frame to be due on the timeline of the
+ * GIF's delays rather than playing as fast as possible, and -n stops each GIF
+ * after that many frames by destroying its generator part way through the
+ * file.
+ *
+ * Every frame is checked against the same GIF played on its own, and against
+ * its dirty rectangle: the pixels outside of it have to be as the frame
+ * before left them.  A line is printed for each GIF, then the totals:
+ *   wifi.gif       254 frames on 4 threads   43% dirty  ok
+ *   7 GIFs  1465 frames on 4 threads in 42.76 ms  ok
+ * The exit status is 1 if any frame didn't match.
+ *
+ * Build and run from this directory:
+ *   c++ -O2 -Wall -std=c++20 -pthread -I../../src -o gifframes GifFrames.cpp
+ *   ./gifframes [-j threads] [-n frames] [-r] file.gif|directory...
+ */
+
+#include "ArduinoShim.h"
+#include "HostFileFunctions.h"
+
+#include <unistd.h>
+
+#include <bit>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HostWorkerPool.h"
+#include "HostGifFrames.h"
+
+#define FRAMES_MAX_THREADS 64
+
+struct Animation {
+  std::string pathname;
+  std::vector<uint8_t> data;
+  std::optional<HostGenerator<GifFrameView>> frames;
+  // Each frame's hash, played on its own
+  std::vector<uint32_t> expected;
+  // The frame before, to check the dirty rectangle with
+  std::vector<uint8_t> previous;
+  // When the next frame is due, in ms from the start
+  unsigned long due;
+  unsigned long played;
+  unsigned long mismatches;
+  uint64_t dirtyPixels;
+  uint64_t pixels;
+  // Bit n set if thread n played a frame
+  uint64_t threads;
+};
+
+static std::vector<Animation> animations;
+static int threadCount = 4;
+static unsigned long frameLimit;
+static bool realTime;
+
+// The animations still playing, queued by their index
+static HostWorkerPool *pool;
+static std::chrono::steady_clock::time_point start;
+
+static uint32_t hashFrame(const GifFrameView &frame) {
+  uint32_t hash = 2166136261UL;
+  for (int y = 0; y < frame.height; y++) {
+    const uint8_t *p = frame.pixels + y * frame.stride;
+    for (int i = 0; i < frame.width * 3; i++)
+      hash = (hash ^ p[i]) * 16777619UL;
+  }
+  return hash;
+}
+
+static void loadFile(const char *pathname) {
+  if (openGifFile(pathname) < 0) {
+    fprintf(stderr, "%s: can't read the file\n", pathname);
+    return;
+  }
+  Animation a = {};
+  a.pathname = pathname;
+  a.data.assign(fileData, fileData + fileSize);
+  animations.push_back(std::move(a));
+}
+
+// Play one frame of the animation, on thread number
+static bool playFrame(Animation &a, int number) {
+  if (frameLimit && a.played == frameLimit)
+    return false;
+  if (!a.frames->next())
+    return false;
+
+  const GifFrameView &frame = a.frames->value();
+  size_t size = frame.height * frame.stride;
+  if (a.previous.size() != size)
+    a.previous.assign(size, 0);
+  bool match = a.played < a.expected.size() &&
+               hashFrame(frame) == a.expected[a.played];
+  for (int y = 0; y < frame.height && match; y++) {
+    const uint8_t *p = frame.pixels + y * frame.stride;
+    const uint8_t *q = a.previous.data() + y * frame.stride;
+    for (int x = 0; x < frame.width; x++) {
+      bool dirty = x >= frame.dirtyX && x < frame.dirtyX + frame.dirtyWidth &&
+                   y >= frame.dirtyY && y < frame.dirtyY + frame.dirtyHeight;
+      if (!dirty && memcmp(p + x * 3, q + x * 3, 3) != 0) {
+        match = false;
+        break;
+      }
+    }
+  }
+  memcpy(a.previous.data(), frame.pixels, size);
+
+  a.mismatches += !match;
+  a.dirtyPixels += (uint64_t)frame.dirtyWidth * frame.dirtyHeight;
+  a.pixels += (uint64_t)frame.width * frame.height;
+  a.threads |= 1ULL << number;
+  a.played++;
+  a.due += frame.delay_ms;
+  return true;
+}
+
+static void player(int number) {
+  int index;
+  while (pool->take(number, &index)) {
+    Animation &a = animations[index];
+    if (realTime)
+      std::this_thread::sleep_until(start + std::chrono::milliseconds(a.due));
+    if (playFrame(a, number)) {
+      pool->push((number + 1) % pool->size(), index);
+    } else {
+      // Destroying the generator stops it, wherever it is in the file
+      a.frames.reset();
+    }
+    pool->done();
+  }
+}
+
+int main(int argc, char **argv) {
+  bool usage = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:n:r")) != -1) {
+    switch (opt) {
+    case 'j':
+      threadCount = atoi(optarg);
+      break;
+    case 'n':
+      frameLimit = strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      realTime = true;
+      break;
+    default:
+      usage = true;
+      break;
+    }
+  }
+  if (usage || optind >= argc || threadCount < 1 ||
+      threadCount > FRAMES_MAX_THREADS) {
+    fprintf(stderr,
+            "usage: %s [-j threads] [-n frames] [-r] file.gif|directory...\n"
+            "  -j  threads to play the GIFs on, up to %d (default 4)\n"
+            "  -n  stop each GIF after this many frames\n"
+            "  -r  play in real time\n",
+            argv[0], FRAMES_MAX_THREADS);
+    return 1;
+  }
+
+  forEachGifFile(argc - optind, argv + optind, loadFile);
+
+  // What each GIF looks like played on its own.  Each worker starts with an
+  // even share of the GIFs
+  pool = new HostWorkerPool(threadCount);
+  for (size_t i = 0; i < animations.size(); i++) {
+    Animation &a = animations[i];
+    for (const GifFrameView &frame : gifFrames(a.data.data(), a.data.size()))
+      a.expected.push_back(hashFrame(frame));
+    a.frames.emplace(gifFrames(a.data.data(), a.data.size()));
+    pool->push(i * threadCount / animations.size(), i);
+  }
+
+  start = std::chrono::steady_clock::now();
+  pool->run(player);
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+
+  unsigned long frames = 0;
+  int failures = 0;
+  for (Animation &a : animations) {
+    unsigned long wanted = a.expected.size();
+    if (frameLimit && frameLimit < wanted)
+      wanted = frameLimit;
+    bool ok = a.mismatches == 0 && a.played == wanted;
+    failures += !ok;
+    frames += a.played;
+    const char *name = strrchr(a.pathname.c_str(), '/');
+    printf("%-12s %5lu frames on %d threads  %3d%% dirty  %s\n",
+           name ? name + 1 : a.pathname.c_str(), a.played,
+           std::popcount(a.threads),
+           a.pixels ? (int)(a.dirtyPixels * 100 / a.pixels) : 0,
+           ok ? "ok" : "MISMATCH");
+  }
+  printf("%zu GIFs  %lu frames on %d threads in %.2f ms  %s\n",
+         animations.size(), frames, threadCount, ms,
+         failures ? "MISMATCH" : "ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,473 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * Rewrites GIFs to be as cheap as possible for the decoder to play:
+ *  - frames are cropped to the rectangle that changed since the previous
+ *    frame, with the unchanged pixels inside it transparent, and left in
+ *    place (disposal 1) so there's no disposal work
+ *  - nothing is interlaced
+ *  - the LZW code width is limited to -b bits with clear codes, so the file
+ *    plays on a decoder built with that lzwMaxBits
+ *
+ * The GIF is played with the decoder into a canvas, so the frames come out
+ * exactly as the decoder would have drawn them.  The result is played back
+ * with a decoder built for -b bits to check it matches, and the decode time
+ * of both files is measured like GifBench does with the line callback.
+ *
+ * Build and run from this directory:
+ *   c++ -O2 -I../../src -o gifoptimize GifOptimize.cpp
+ *   ./gifoptimize [-b bits] [-n passes] -o out.gif file.gif
+ *   ./gifoptimize [-b bits] [-n passes] -d outdir file.gif|directory...
+ */
+
+#include "ArduinoShim.h"
+#include "HostFileFunctions.h"
+#include "HostCanvas.h"
+#include "HostLzwEncoder.h"
+
+#include <unistd.h>
+
+#include <GifDecoder.h>
+
+static int lzwBits = 12;
+static int passes = 20;
+static const char *outputPathname;
+static const char *outputDirectory;
+
+// The output file is built in memory
+static uint8_t *out;
+static unsigned long outSize;
+static unsigned long outCapacity;
+
+static void put(const void *data, unsigned long len) {
+  if (outSize + len > outCapacity) {
+    outCapacity = (outSize + len) * 2;
+    out = (uint8_t *)realloc(out, outCapacity);
+  }
+  memcpy(out + outSize, data, len);
+  outSize += len;
+}
+
+static void putByte(uint8_t b) { put(&b, 1); }
+
+static void putWord(uint16_t w) {
+  putByte(w & 0xff);
+  putByte(w >> 8);
+}
+
+static void writeImageData(const uint8_t *pixels, int count, int minCodeSize) {
+  lzwEncode(pixels, count, minCodeSize, lzwBits);
+  put(lzwData, lzwDataSize);
+}
+
+// Color table size field for a table with count entries: 2^(bits + 1) >= count
+static int tableSizeBits(int count) {
+  int bits = 0;
+  while ((2 << bits) < count)
+    bits++;
+  return bits;
+}
+
+static void putColorTable(const uint32_t *colors, int count) {
+  int size = 2 << tableSizeBits(count);
+  for (int i = 0; i < size; i++) {
+    uint32_t c = (i < count) ? colors[i] : 0;
+    putByte(c >> 16);
+    putByte(c >> 8);
+    putByte(c);
+  }
+}
+
+// The global color table: the GIF's own if it has one, as most frames use it,
+// otherwise the first frame's colors
+static uint32_t globalColors[256];
+static int globalCount;
+
+static void chooseGlobalColors(int width, int height) {
+  globalCount = 0;
+  if (fileSize > 13 && (fileData[10] & 0x80)) {
+    int count = 2 << (fileData[10] & 7);
+    if (13 + 3UL * count <= fileSize) {
+      for (int i = 0; i < count; i++) {
+        const uint8_t *rgb = fileData + 13 + 3 * i;
+        globalColors[globalCount++] = (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+      }
+      return;
+    }
+  }
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      uint32_t c = canvasPixel(x, y);
+      int k = 0;
+      while (k < globalCount && globalColors[k] != c)
+        k++;
+      if (k == globalCount && globalCount < 256)
+        globalColors[globalCount++] = c;
+    }
+  }
+}
+
+static unsigned long frameCount;
+static unsigned long localTables;
+
+// Write the frames for the rectangle x, y, width, height where pending marks
+// the pixels that changed.  An empty rectangle is written as one transparent
+// pixel, to keep the delay.  If the pixels need more colors than a table
+// holds, the rest are left for more frames with no delay
+static void writeFrame(int x, int y, int width, int height,
+                       unsigned int delay) {
+  static uint8_t indexes[CANVAS_MAX_WIDTH * CANVAS_MAX_HEIGHT];
+
+  if (width == 0) {
+    width = height = 1;
+    pending[0] = 0;
+  }
+
+  bool continued;
+  do {
+    // Colors needed, in order of first use
+    uint32_t colors[257];
+    int colorCount = 0;
+    bool unchanged = false;
+    for (int j = 0; j < height; j++) {
+      for (int i = 0; i < width; i++) {
+        if (!pending[j * width + i]) {
+          unchanged = true;
+          continue;
+        }
+        uint32_t c = canvasPixel(x + i, y + j);
+        int k = 0;
+        while (k < colorCount && colors[k] != c)
+          k++;
+        if (k == colorCount && colorCount < 257)
+          colors[colorCount++] = c;
+      }
+    }
+    continued = colorCount > (unchanged ? 255 : 256);
+    if (continued) {
+      colorCount = 255;
+      unchanged = true;
+    }
+
+    // Use the global table if it has all the colors, and an index that's
+    // free for transparent pixels if one is needed
+    uint8_t map[256];
+    bool used[256] = {false};
+    bool global = true;
+    for (int k = 0; k < colorCount && global; k++) {
+      int p = 0;
+      while (p < globalCount && globalColors[p] != colors[k])
+        p++;
+      global = p < globalCount;
+      if (global) {
+        map[k] = p;
+        used[p] = true;
+      }
+    }
+    int transparent = -1;
+    if (global && unchanged) {
+      for (int p = 0; p < (2 << tableSizeBits(globalCount)) && transparent < 0;
+           p++) {
+        if (!used[p])
+          transparent = p;
+      }
+      global = transparent >= 0;
+    }
+    const uint32_t *table = globalColors;
+    int tableCount = globalCount;
+    if (!global) {
+      for (int k = 0; k < colorCount; k++)
+        map[k] = k;
+      table = colors;
+      tableCount = colorCount;
+      transparent = -1;
+      if (unchanged) {
+        transparent = tableCount;
+        colors[tableCount++] = 0;
+      }
+      localTables++;
+    }
+
+    // Unchanged pixels are transparent, unless drawing them again continues
+    // a run of the same index, which compresses better
+    for (int j = 0; j < height; j++) {
+      int left = -1;
+      for (int i = 0; i < width; i++) {
+        uint8_t *p = &pending[j * width + i];
+        uint32_t c = canvasPixel(x + i, y + j);
+        int index = transparent;
+        if (*p) {
+          for (int k = 0; k < colorCount; k++) {
+            if (colors[k] == c) {
+              index = map[k];
+              *p = 0;
+              break;
+            }
+          }
+        } else if (left >= 0 && left != transparent && left < tableCount &&
+                   table[left] == c) {
+          index = left;
+        }
+        indexes[j * width + i] = index;
+        left = index;
+      }
+    }
+
+    // Graphic control extension: leave the frame in place
+    putByte(0x21);
+    putByte(0xf9);
+    putByte(4);
+    putByte((1 << 2) | (transparent >= 0 ? 1 : 0));
+    putWord(continued ? 0 : delay);
+    putByte(transparent >= 0 ? transparent : 0);
+    putByte(0);
+
+    putByte(0x2c);
+    putWord(x);
+    putWord(y);
+    putWord(width);
+    putWord(height);
+    int bits = tableSizeBits(tableCount);
+    if (global) {
+      bits = tableSizeBits(globalCount);
+      putByte(0);
+    } else {
+      putByte(0x80 | bits);
+      putColorTable(colors, tableCount);
+    }
+    writeImageData(indexes, width * height, (bits + 1 < 2) ? 2 : bits + 1);
+    frameCount++;
+  } while (continued);
+}
+
+// Decode time in us per frame with the line callback, like GifBench
+static void drawLineCallback(int16_t x, int16_t y, uint8_t *buf, int16_t wid,
+                             uint16_t *palette565, int16_t skip) {}
+
+template <int bits>
+static GifDecoder<CANVAS_MAX_WIDTH, CANVAS_MAX_HEIGHT, bits> &decoderFor(void) {
+  static GifDecoder<CANVAS_MAX_WIDTH, CANVAS_MAX_HEIGHT, bits> decoder;
+  decoder.setFileSeekCallback(fileSeekCallback);
+  decoder.setFilePositionCallback(filePositionCallback);
+  decoder.setFileReadCallback(fileReadCallback);
+  decoder.setFileReadBlockCallback(fileReadBlockCallback);
+  decoder.setScreenClearCallback(screenClearCallback);
+  return decoder;
+}
+
+template <int bits> static double decodeCost(void) {
+  GifDecoder<CANVAS_MAX_WIDTH, CANVAS_MAX_HEIGHT, bits> &decoder =
+      decoderFor<bits>();
+  decoder.setDrawPixelCallback(NULL);
+  decoder.setDrawLineCallback(drawLineCallback);
+  int frames = 0;
+  double time = 0;
+  filePosition = 0;
+  decoder.startDecoding();
+  for (int pass = 0; pass < passes; pass++) {
+    for (;;) {
+      // Timed per frame, as hostNanos() wraps every few seconds
+      uint32_t start = hostNanos();
+      int result = decoder.decodeFrame(false);
+      time += (uint32_t)(hostNanos() - start);
+      if (result != ERROR_NONE)
+        break;
+      frames++;
+    }
+  }
+  return frames ? time / 1000 / frames : 0;
+}
+
+// Hashes of each frame of the original, to check the output against
+static uint32_t *frameHashes;
+static int frameHashCount;
+
+static uint32_t canvasHash(int width, int height) {
+  uint32_t hash = 2166136261UL;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++)
+      hash = (hash ^ canvasPixel(x, y)) * 16777619UL;
+  }
+  return hash;
+}
+
+// Play the output and check each frame with a delay matches the original,
+// returns the first frame that doesn't, or -1
+template <int bits> static int verify(int width, int height) {
+  GifDecoder<CANVAS_MAX_WIDTH, CANVAS_MAX_HEIGHT, bits> &decoder =
+      decoderFor<bits>();
+  decoder.setDrawLineCallback(NULL);
+  decoder.setDrawPixelCallback(drawPixelCallback);
+  filePosition = 0;
+  memset(canvas, 0, sizeof(canvas));
+  decoder.startDecoding();
+  int frame = 0;
+  int result;
+  while ((result = decoder.decodeFrame(false)) == ERROR_NONE) {
+    // Split frames are only complete at the one with the delay
+    if (decoder.getFrameDelay_ms() == 0 && frame < frameHashCount &&
+        canvasHash(width, height) != frameHashes[frame])
+      continue;
+    if (frame >= frameHashCount ||
+        canvasHash(width, height) != frameHashes[frame])
+      return frame;
+    frame++;
+  }
+  return (result < 0 || frame != frameHashCount) ? frame : -1;
+}
+
+static double outputDecodeCost(void) {
+  switch (lzwBits) {
+  case 9:
+    return decodeCost<9>();
+  case 10:
+    return decodeCost<10>();
+  case 11:
+    return decodeCost<11>();
+  default:
+    return decodeCost<12>();
+  }
+}
+
+static int verifyOutput(int width, int height) {
+  switch (lzwBits) {
+  case 9:
+    return verify<9>(width, height);
+  case 10:
+    return verify<10>(width, height);
+  case 11:
+    return verify<11>(width, height);
+  default:
+    return verify<12>(width, height);
+  }
+}
+
+static void optimizeGif(const char *pathname) {
+  if (openGifFile(pathname) < 0) {
+    perror(pathname);
+    return;
+  }
+  GifDecoder<CANVAS_MAX_WIDTH, CANVAS_MAX_HEIGHT, 12> &decoder =
+      decoderFor<12>();
+  decoder.setDrawLineCallback(NULL);
+  decoder.setDrawPixelCallback(drawPixelCallback);
+  if (decoder.startDecoding() < 0 || decoder.isFastFormat()) {
+    fprintf(stderr, "%s: not a GIF\n", pathname);
+    return;
+  }
+  uint16_t width, height;
+  decoder.getSize(&width, &height);
+  if (width > CANVAS_MAX_WIDTH || height > CANVAS_MAX_HEIGHT) {
+    fprintf(stderr, "%s: larger than %dx%d\n", pathname, CANVAS_MAX_WIDTH,
+            CANVAS_MAX_HEIGHT);
+    return;
+  }
+
+  outSize = 0;
+  frameCount = 0;
+  localTables = 0;
+  frameHashCount = 0;
+  memset(canvas, 0, sizeof(canvas));
+  int frames = 0;
+  while (decoder.decodeFrame(false) == ERROR_NONE) {
+    if (frames == 0) {
+      chooseGlobalColors(width, height);
+      put("GIF89a", 6);
+      putWord(width);
+      putWord(height);
+      putByte(0x80 | 0x70 | tableSizeBits(globalCount));
+      putByte(0); // background
+      putByte(0); // aspect ratio
+      putColorTable(globalColors, globalCount);
+      put("\x21\xff\x0bNETSCAPE2.0\x03\x01", 16);
+      putWord(findLoopCount());
+      putByte(0);
+    }
+    int x, y, w, h;
+    findChangedRect(width, height, frames == 0, &x, &y, &w, &h);
+    frameHashes = (uint32_t *)realloc(frameHashes,
+                                      (frameHashCount + 1) * sizeof(uint32_t));
+    frameHashes[frameHashCount++] = canvasHash(width, height);
+    writeFrame(x, y, w, h, decoder.getFrameDelay_ms() / 10);
+    frames++;
+  }
+  if (frames == 0) {
+    fprintf(stderr, "%s: no frames\n", pathname);
+    return;
+  }
+  putByte(0x3b);
+
+  char pathBuffer[1024];
+  const char *output = outputPathname;
+  if (!output) {
+    const char *name = strrchr(pathname, '/') ? strrchr(pathname, '/') + 1
+                                              : pathname;
+    snprintf(pathBuffer, sizeof(pathBuffer), "%s/%s", outputDirectory, name);
+    output = pathBuffer;
+  }
+  FILE *f = fopen(output, "wb");
+  if (!f || fwrite(out, 1, outSize, f) != outSize) {
+    perror(output);
+    if (f)
+      fclose(f);
+    return;
+  }
+  fclose(f);
+
+  // Cost of the original, then of the output from memory
+  unsigned long gifSize = fileSize;
+  double before = decodeCost<12>();
+  uint8_t *gifData = fileData;
+  fileData = out;
+  fileSize = outSize;
+  double after = outputDecodeCost();
+  int bad = verifyOutput(width, height);
+  fileData = gifData;
+  fileSize = gifSize;
+
+  printf("%s: %d frames (%lu written, %lu local color tables), %lu -> %lu "
+         "bytes, %.1f -> %.1f us/frame with %d-bit LZW\n",
+         output, frames, frameCount, localTables, gifSize, outSize, before,
+         after, lzwBits);
+  if (bad >= 0)
+    printf("%s: frame %d doesn't match the original\n", output, bad);
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "b:n:o:d:")) != -1) {
+    switch (opt) {
+    case 'b':
+      lzwBits = atoi(optarg);
+      break;
+    case 'n':
+      passes = atoi(optarg);
+      break;
+    case 'o':
+      outputPathname = optarg;
+      break;
+    case 'd':
+      outputDirectory = optarg;
+      break;
+    default:
+      break;
+    }
+  }
+  if (lzwBits < 9 || lzwBits > 12 || passes < 1 ||
+      !(outputPathname || outputDirectory) || optind == argc) {
+    fprintf(stderr,
+            "usage: %s [-b bits] [-n passes] -o out.gif | -d outdir "
+            "file.gif|directory...\n"
+            "  -b  largest LZW code width, 9 to 12 (default 12), the output "
+            "plays with\n"
+            "      a decoder built with this lzwMaxBits\n"
+            "  -n  passes to time decoding over (default 20)\n"
+            "  -o  output file, when optimizing one GIF\n"
+            "  -d  directory to write the optimized GIFs to\n",
+            argv[0]);
+    return 1;
+  }
+
+  forEachGifFile(argc - optind, argv + optind, optimizeGif);
+  return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * Writes a Chrome trace-event JSON timeline of the decoder playing a list of
+ * GIFs, to open in chrome://tracing or https://ui.perfetto.dev
+ *
+ * Thread 1 has a span per GIF, per decodeFrame() call, and per decoding phase,
+ * plus an instant event for every frame presented later than its frame delay
+ * allows.  Thread 2 has a span per file callback.
+ *
+ * Without -r frames are decoded back to back, and a frame is late if decoding
+ * it took longer than the previous frame's delay.  With -r the decoder waits
+ * for each frame delay like it does on a display, and reports late frames.
+ *
+ * Build and run from this directory:
+ *   c++ -O2 -I../../src -o giftrace GifTrace.cpp
+ *   ./giftrace -o trace.json ../gifs
+ */
+
+#include "ArduinoShim.h"
+#include "HostFileFunctions.h"
+
+#include <unistd.h>
+
+#define GIF_PROFILING
+#define GIF_PROFILE_CLOCK() hostNanos()
+#include <GifDecoder.h>
+
+#define TRACE_MAX_WIDTH 320
+#define TRACE_MAX_HEIGHT 320
+
+#define TID_DECODER 1
+#define TID_FILE 2
+
+static GifDecoder<TRACE_MAX_WIDTH, TRACE_MAX_HEIGHT, 12> decoder;
+
+static FILE *traceFile;
+static bool firstEvent = true;
+static int currentPhase = GIF_PHASE_NONE;
+
+// hostNanos() wraps every ~4.3 seconds, extend it to 64 bits.  Events come
+// much more often than that, so a smaller time means the clock wrapped
+static uint64_t traceTime(uint32_t nanos) {
+  static uint64_t high;
+  static uint32_t last;
+  if (nanos < last)
+    high += (uint64_t)1 << 32;
+  last = nanos;
+  return high + nanos;
+}
+
+// Start an event, the caller adds any more fields and closes it with "}"
+static void beginEvent(const char *name, const char *ph, uint32_t nanos,
+                       int tid) {
+  fprintf(traceFile, "%s\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,"
+                     "\"tid\":%d",
+          firstEvent ? "" : ",", name, ph, traceTime(nanos) / 1000.0, tid);
+  firstEvent = false;
+}
+
+static void traceCallback(int event, uint32_t time, uint32_t value) {
+  if (event == GIF_TRACE_LATE_PRESENT) {
+    beginEvent("late present", "i", time, TID_DECODER);
+    fprintf(traceFile, ",\"s\":\"t\",\"args\":{\"late_us\":%u}}",
+            (unsigned)value);
+    return;
+  }
+
+  // Phases don't overlap, one ends when the next starts
+  if (currentPhase != GIF_PHASE_NONE) {
+    beginEvent(decoder.getPhaseName(currentPhase), "E", time, TID_DECODER);
+    fputs("}", traceFile);
+  }
+  currentPhase = event;
+  if (currentPhase != GIF_PHASE_NONE) {
+    beginEvent(decoder.getPhaseName(currentPhase), "B", time, TID_DECODER);
+    fputs("}", traceFile);
+  }
+}
+
+// File callbacks that add a span for each call
+static void traceFileCall(const char *name, uint32_t start, int bytes) {
+  uint32_t end = hostNanos();
+  beginEvent(name, "X", start, TID_FILE);
+  fprintf(traceFile, ",\"dur\":%.3f,\"args\":{\"bytes\":%d}}",
+          (end - start) / 1000.0, bytes);
+}
+
+bool traceSeekCallback(unsigned long position) {
+  uint32_t start = hostNanos();
+  bool result = fileSeekCallback(position);
+  traceFileCall("seek", start, 0);
+  return result;
+}
+
+int traceReadCallback(void) {
+  uint32_t start = hostNanos();
+  int result = fileReadCallback();
+  traceFileCall("read", start, 1);
+  return result;
+}
+
+int traceReadBlockCallback(void *buffer, int numberOfBytes) {
+  uint32_t start = hostNanos();
+  int result = fileReadBlockCallback(buffer, numberOfBytes);
+  traceFileCall("readBlock", start, result);
+  return result;
+}
+
+void drawLineCallback(int16_t x, int16_t y, uint8_t *buf, int16_t wid,
+                      uint16_t *palette565, int16_t skip) {}
+
+static bool realTime;
+static int passes = 1;
+
+static void traceGif(const char *pathname) {
+  if (openGifFile(pathname) < 0) {
+    fprintf(stderr, "%s: can't open\n", pathname);
+    return;
+  }
+  const char *name =
+      strrchr(pathname, '/') ? strrchr(pathname, '/') + 1 : pathname;
+
+  beginEvent(name, "B", hostNanos(), TID_DECODER);
+  fputs("}", traceFile);
+
+  decoder.startDecoding();
+  unsigned int priorFrameDelay = 0;
+  int pass = 0;
+  while (pass < passes) {
+    uint32_t start = hostNanos();
+    beginEvent("decodeFrame", "B", start, TID_DECODER);
+    fputs("}", traceFile);
+
+    int result = decoder.decodeFrame(realTime);
+
+    uint32_t end = hostNanos();
+    beginEvent("decodeFrame", "E", end, TID_DECODER);
+    fprintf(traceFile, ",\"args\":{\"frame\":%lu,\"result\":%d}}",
+            decoder.getFrameNo(), result);
+
+    if (result < 0)
+      break;
+    if (result == ERROR_DONE_PARSING) {
+      pass++;
+      continue;
+    }
+    // Decoding back to back, the frame is late if it took longer than the
+    // time the previous frame was to be shown for
+    if (!realTime && pass + decoder.getFrameNo() > 1 &&
+        (end - start) / 1000 > priorFrameDelay * 1000) {
+      beginEvent("late present", "i", end, TID_DECODER);
+      fprintf(traceFile, ",\"s\":\"t\",\"args\":{\"late_us\":%u}}",
+              (unsigned)((end - start) / 1000 - priorFrameDelay * 1000));
+    }
+    priorFrameDelay = decoder.getFrameDelay_ms();
+  }
+
+  beginEvent(name, "E", hostNanos(), TID_DECODER);
+  fputs("}", traceFile);
+}
+
+int main(int argc, char **argv) {
+  const char *output = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "o:rp:")) != -1) {
+    switch (opt) {
+    case 'o':
+      output = optarg;
+      break;
+    case 'r':
+      realTime = true;
+      break;
+    case 'p':
+      passes = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr,
+              "usage: %s [-o trace.json] [-r] [-p passes] file.gif|directory...\n"
+              "  -r  wait for frame delays like on a display\n"
+              "  -p  number of times to play each GIF (default 1)\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  traceFile = output ? fopen(output, "w") : stdout;
+  if (!traceFile) {
+    perror(output);
+    return 1;
+  }
+
+  decoder.setFileSeekCallback(traceSeekCallback);
+  decoder.setFilePositionCallback(filePositionCallback);
+  decoder.setFileReadCallback(traceReadCallback);
+  decoder.setFileReadBlockCallback(traceReadBlockCallback);
+  decoder.setDrawLineCallback(drawLineCallback);
+  decoder.setTraceCallback(traceCallback);
+
+  fputs("{\"traceEvents\":[", traceFile);
+  forEachGifFile(argc - optind, argv + optind, traceGif);
+  fputs("\n],\"displayTimeUnit\":\"ms\"}\n", traceFile);
+
+  if (output)
+    fclose(traceFile);
+  return 0;
+}
@@ -0,0 +1,353 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * Converts GIFs to the pre-decoded fast playback format (.fgf), see
+ * src/FastGifDecoder_Impl.h.  The GIF is played with the decoder into a
+ * canvas, so the frames come out exactly as the decoder would have drawn
+ * them, then each frame is stored as the rectangle that changed since the
+ * previous frame, with unchanged pixels inside it transparent.  The first
+ * frame is stored whole, so each loop starts from the same image even where
+ * the GIF only draws part of the screen.
+ *
+ * Build and run from this directory:
+ *   c++ -O2 -I../../src -o giftranscode GifTranscode.cpp
+ *   ./giftranscode [-a alignment] [-o out.fgf] file.gif|directory...
+ *
+ * Each file.gif is written to file.fgf, or to -o when converting one file.
+ * -a sets the alignment of each frame record in bytes (default 512, the SD
+ * card sector size, 1 for no padding)
+ */
+
+#include "ArduinoShim.h"
+#include "HostFileFunctions.h"
+#include "HostCanvas.h"
+
+#include <unistd.h>
+
+#include <GifDecoder.h>
+
+static GifDecoder<CANVAS_MAX_WIDTH, CANVAS_MAX_HEIGHT, 12> decoder;
+
+static int alignShift = 9;
+static const char *outputPathname;
+
+// The output file is built in memory, the header is finished at the end
+static uint8_t *out;
+static unsigned long outSize;
+static unsigned long outCapacity;
+
+static void put(const void *data, unsigned long len) {
+  if (outSize + len > outCapacity) {
+    outCapacity = (outSize + len) * 2;
+    out = (uint8_t *)realloc(out, outCapacity);
+  }
+  memcpy(out + outSize, data, len);
+  outSize += len;
+}
+
+static void putByte(uint8_t b) { put(&b, 1); }
+
+static void putWord(uint16_t w) {
+  putByte(w & 0xff);
+  putByte(w >> 8);
+}
+
+static void setWord(unsigned long offset, uint16_t w) {
+  out[offset] = w & 0xff;
+  out[offset + 1] = w >> 8;
+}
+
+static void padToAlignment(void) {
+  while (outSize & ((1UL << alignShift) - 1))
+    putByte(0);
+}
+
+// Run-length encode a row: literal packets of 1 to 128 bytes, runs of 3 to
+// 129 of the same byte (shorter runs aren't worth ending a literal for)
+static void encodeRow(const uint8_t *row, int width, uint8_t *encoded,
+                      int *encodedLen) {
+  int len = 0;
+  int x = 0;
+  while (x < width) {
+    int run = 1;
+    while (x + run < width && run < 129 && row[x + run] == row[x])
+      run++;
+    if (run >= 3) {
+      encoded[len++] = run + 126;
+      encoded[len++] = row[x];
+      x += run;
+      continue;
+    }
+    // Literal up to the next run of 3 or more
+    int start = x;
+    while (x < width && x - start < 128) {
+      if (x + 2 < width && row[x] == row[x + 1] && row[x] == row[x + 2])
+        break;
+      x++;
+    }
+    encoded[len++] = x - start - 1;
+    memcpy(encoded + len, row + start, x - start);
+    len += x - start;
+  }
+  *encodedLen = len;
+}
+
+// Palette of the last record written
+static uint32_t palette[256];
+static int paletteCount;
+
+static unsigned long recordCount;
+static unsigned long paletteChanges;
+
+// Write the records for one frame: the rectangle x, y, width, height where
+// pending marks the pixels that changed
+static void writeFrame(int x, int y, int width, int height,
+                       unsigned int delay) {
+  static uint8_t indexes[CANVAS_MAX_WIDTH * CANVAS_MAX_HEIGHT];
+  static uint8_t encoded[CANVAS_MAX_WIDTH * CANVAS_MAX_HEIGHT * 2];
+  static uint8_t rowEncoded[CANVAS_MAX_WIDTH * 2];
+
+  bool continued;
+  do {
+    // Colors needed, in order of first use
+    uint32_t colors[257];
+    int colorCount = 0;
+    bool unchanged = false;
+    for (int j = 0; j < height; j++) {
+      for (int i = 0; i < width; i++) {
+        if (!pending[j * width + i]) {
+          unchanged = true;
+          continue;
+        }
+        uint32_t c = canvasPixel(x + i, y + j);
+        int k = 0;
+        while (k < colorCount && colors[k] != c)
+          k++;
+        if (k == colorCount && colorCount < 257)
+          colors[colorCount++] = c;
+      }
+    }
+
+    // Too many colors: this record takes the first 255, leaving the rest
+    // transparent for the next record
+    continued = colorCount > (unchanged ? 255 : 256);
+    if (continued) {
+      colorCount = 255;
+      unchanged = true;
+    }
+
+    // Keep the previous palette if it has all the colors, and an index
+    // that's free for transparent pixels if one is needed
+    uint8_t map[256];
+    bool used[256] = {false};
+    bool reuse = true;
+    for (int k = 0; k < colorCount && reuse; k++) {
+      int p = 0;
+      while (p < paletteCount && palette[p] != colors[k])
+        p++;
+      reuse = p < paletteCount;
+      if (reuse) {
+        map[k] = p;
+        used[p] = true;
+      }
+    }
+    int skip = -1;
+    if (reuse && unchanged) {
+      for (int p = 0; p < 256 && skip < 0; p++) {
+        if (!used[p])
+          skip = p;
+      }
+      reuse = skip >= 0;
+    }
+    if (!reuse) {
+      // New palette with the colors needed, then as many of the previous
+      // palette's colors as fit, as later frames are likely to use them
+      int count = colorCount;
+      for (int p = 0; p < paletteCount && count < (unchanged ? 255 : 256);
+           p++) {
+        int k = 0;
+        while (k < count && colors[k] != palette[p])
+          k++;
+        if (k == count)
+          colors[count++] = palette[p];
+      }
+      for (int k = 0; k < count; k++) {
+        palette[k] = colors[k];
+        map[k] = k;
+      }
+      paletteCount = count;
+      if (unchanged) {
+        skip = paletteCount;
+        palette[paletteCount++] = 0;
+      }
+      paletteChanges++;
+    }
+
+    // Index every pixel, clearing pending for the ones done by this record
+    for (int j = 0; j < height; j++) {
+      for (int i = 0; i < width; i++) {
+        uint8_t *p = &pending[j * width + i];
+        uint8_t index = skip;
+        if (*p) {
+          uint32_t c = canvasPixel(x + i, y + j);
+          for (int k = 0; k < colorCount; k++) {
+            if (colors[k] == c) {
+              index = map[k];
+              *p = 0;
+              break;
+            }
+          }
+        }
+        indexes[j * width + i] = index;
+      }
+    }
+
+    // Use run-length encoding if it's smaller
+    int encodedLen = 0;
+    for (int j = 0; j < height; j++) {
+      int len;
+      encodeRow(indexes + j * width, width, rowEncoded, &len);
+      memcpy(encoded + encodedLen, rowEncoded, len);
+      encodedLen += len;
+    }
+    bool rle = encodedLen < width * height;
+
+    unsigned long recordStart = outSize;
+    putWord(0); // size, set below
+    putWord(0);
+    putByte((rle ? FASTGIF_RLE : 0) | (skip >= 0 ? FASTGIF_TRANSPARENT : 0) |
+            (continued ? FASTGIF_CONTINUED : 0));
+    putByte(skip >= 0 ? skip : 0);
+    putWord(continued ? 0 : delay);
+    putWord(x);
+    putWord(y);
+    putWord(width);
+    putWord(height);
+    putWord(reuse ? 0 : paletteCount);
+    putWord(0);
+    if (!reuse) {
+      for (int k = 0; k < paletteCount; k++) {
+        putByte(palette[k] >> 16);
+        putByte(palette[k] >> 8);
+        putByte(palette[k]);
+      }
+    }
+    if (rle)
+      put(encoded, encodedLen);
+    else
+      put(indexes, width * height);
+    padToAlignment();
+    unsigned long recordSize = outSize - recordStart;
+    setWord(recordStart, recordSize & 0xffff);
+    setWord(recordStart + 2, recordSize >> 16);
+    recordCount++;
+  } while (continued);
+}
+
+static void transcodeGif(const char *pathname) {
+  int len = strlen(pathname);
+  if (len > 4 && strcasecmp(pathname + len - 4, ".fgf") == 0)
+    return;
+  if (openGifFile(pathname) < 0) {
+    perror(pathname);
+    return;
+  }
+  unsigned long gifSize = fileSize;
+
+  if (decoder.startDecoding() < 0 || decoder.isFastFormat()) {
+    fprintf(stderr, "%s: not a GIF\n", pathname);
+    return;
+  }
+  uint16_t width, height;
+  decoder.getSize(&width, &height);
+  if (width > CANVAS_MAX_WIDTH || height > CANVAS_MAX_HEIGHT) {
+    fprintf(stderr, "%s: larger than %dx%d\n", pathname, CANVAS_MAX_WIDTH,
+            CANVAS_MAX_HEIGHT);
+    return;
+  }
+
+  outSize = 0;
+  paletteCount = 0;
+  recordCount = 0;
+  paletteChanges = 0;
+  put(FASTGIF_MAGIC, FASTGIF_MAGIC_SIZE);
+  putByte(FASTGIF_VERSION);
+  putByte(alignShift);
+  putWord(width);
+  putWord(height);
+  putWord(0); // frames, set below
+  putWord(findLoopCount());
+  putWord(0);
+  padToAlignment();
+
+  memset(canvas, 0, sizeof(canvas));
+  int frames = 0;
+  while (decoder.decodeFrame(false) == ERROR_NONE) {
+    // Everything for the first frame, as the display could be showing
+    // anything
+    int x, y, w, h;
+    findChangedRect(width, height, frames == 0, &x, &y, &w, &h);
+    writeFrame(x, y, w, h, decoder.getFrameDelay_ms() / 10);
+    frames++;
+  }
+  setWord(10, frames);
+
+  char fgfPathname[1024];
+  const char *output = outputPathname;
+  if (!output) {
+    snprintf(fgfPathname, sizeof(fgfPathname), "%.*s.fgf",
+             (len > 4 && strcasecmp(pathname + len - 4, ".gif") == 0) ? len - 4
+                                                                      : len,
+             pathname);
+    output = fgfPathname;
+  }
+  FILE *f = fopen(output, "wb");
+  if (!f || fwrite(out, 1, outSize, f) != outSize) {
+    perror(output);
+    if (f)
+      fclose(f);
+    return;
+  }
+  fclose(f);
+
+  printf("%s: %d frames, %lu records, %lu palettes, %lu -> %lu bytes\n",
+         output, frames, recordCount, paletteChanges, gifSize, outSize);
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "a:o:")) != -1) {
+    switch (opt) {
+    case 'a': {
+      int alignment = atoi(optarg);
+      for (alignShift = 0; (1 << alignShift) < alignment; alignShift++)
+        ;
+      if (alignment < 1 || (1 << alignShift) != alignment) {
+        fprintf(stderr, "alignment must be a power of 2\n");
+        return 1;
+      }
+      break;
+    }
+    case 'o':
+      outputPathname = optarg;
+      break;
+    default:
+      fprintf(stderr,
+              "usage: %s [-a alignment] [-o out.fgf] file.gif|directory...\n"
+              "  -a  align frame records to this many bytes (default 512)\n"
+              "  -o  output file, when converting one GIF\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  decoder.setScreenClearCallback(screenClearCallback);
+  decoder.setDrawPixelCallback(drawPixelCallback);
+  decoder.setFileSeekCallback(fileSeekCallback);
+  decoder.setFilePositionCallback(filePositionCallback);
+  decoder.setFileReadCallback(fileReadCallback);
+  decoder.setFileReadBlockCallback(fileReadBlockCallback);
+
+  forEachGifFile(argc - optind, argv + optind, transcodeGif);
+  return 0;
+}
@@ -0,0 +1,450 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * Drives a video wall of panels from one decode.  The wall is -g columns x
+ * rows of -p width x height panels, each with a driver thread of its own, like
+ * HUB75 panels with an output each.  The decoder's panel map (see
+ * GIF_OUTPUT_TRANSFORM) cuts every line and disposal rectangle at the panel
+ * edges, and the callbacks here push the pieces, in the panel's coordinates
+ * and already converted to RGB, onto that panel's queue.  Each queue is a
+ * lock-free ring with one writer and one reader, so a driver only holds up
+ * the decoder if it falls a whole queue behind, and the LZW decoding is done
+ * once for the whole wall instead of once per panel.
+ *
+ * For each GIF one pass is decoded, timing the decode and the drivers
+ * draining their queues against decoding the GIF once per panel (with a
+ * viewport each, drawing nothing), and every frame each driver shows is
+ * checked against the same frame decoded for the whole wall:
+ *   star.gif    48 frames  24 panels  4.24 ms fan-out  10.71 ms per panel
+ *     4248 commands  38 stalls  ok
+ * The exit status is 1 if any GIF failed or didn't match.
+ *
+ * Build and run from this directory:
+ *   c++ -O2 -pthread -I../../src -o gifwall GifWall.cpp
+ *   ./gifwall [-p widthxheight] [-g columnsxrows] [-q slots]
+ *             file.gif|directory...
+ */
+
+#include "ArduinoShim.h"
+#include "HostFileFunctions.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#define GIF_OUTPUT_TRANSFORM
+#include <GifDecoder.h>
+
+#define WALL_MAX_WIDTH 512
+#define WALL_MAX_HEIGHT 512
+#define PANEL_MAX_WIDTH 128
+#define PANEL_MAX_HEIGHT 128
+#define WALL_MAX_PANELS 64
+
+// Drivers with an empty queue yield this many times, then sleep between looks
+#define DRIVER_SPINS 64
+#define DRIVER_SLEEP_MICROS 20
+
+// The wall's decoder draws rgb_24 lines, in the panel chain's coordinates.
+// The other decodes the whole wall, or a panel at a time, to compare with
+static GifDecoder<WALL_MAX_WIDTH, WALL_MAX_HEIGHT, 12, GIF_PIXEL_RGB24> decoder;
+static GifDecoder<WALL_MAX_WIDTH, WALL_MAX_HEIGHT, 12, GIF_PIXEL_RGB24>
+    reference;
+
+static int panelWidth = 32;
+static int panelHeight = 32;
+static int columns = 2;
+static int rows = 2;
+static int queueSlots = 256;
+
+enum {
+  COMMAND_PIXELS, // a run of pixels, width long, at x, y
+  COMMAND_CLEAR,
+  COMMAND_SAVE, // save the rectangle at x, y, for a disposal method 3 frame
+  COMMAND_RESTORE,
+  COMMAND_FRAME, // the frame is complete, show it
+  COMMAND_STOP
+};
+
+struct Command {
+  uint8_t type;
+  int16_t x;
+  int16_t y;
+  int16_t width;
+  int16_t height;
+  rgb_24 pixels[PANEL_MAX_WIDTH];
+};
+
+struct Panel {
+  std::thread driver;
+  std::vector<Command> slots;
+  // Commands are written at tail by the decoder and read at head by the
+  // driver, each counting up forever
+  alignas(64) std::atomic<uint32_t> head;
+  alignas(64) std::atomic<uint32_t> tail;
+
+  // The decoder's counts
+  unsigned long commands;
+  unsigned long stalls;
+
+  // The driver's: what it shows, the rectangle it saved, and a hash of each
+  // frame it showed
+  rgb_24 screen[PANEL_MAX_WIDTH * PANEL_MAX_HEIGHT];
+  rgb_24 saved[PANEL_MAX_WIDTH * PANEL_MAX_HEIGHT];
+  std::vector<uint32_t> frames;
+};
+
+static Panel *panels[WALL_MAX_PANELS];
+static int panelCount;
+static uint8_t panelMap[WALL_MAX_PANELS];
+
+// The whole wall as the reference decoder draws it, its saved rectangle, and
+// each frame's hash for each panel
+static rgb_24 wall[WALL_MAX_WIDTH * WALL_MAX_HEIGHT];
+static rgb_24 wallSaved[WALL_MAX_WIDTH * WALL_MAX_HEIGHT];
+static std::vector<uint32_t> wallFrames[WALL_MAX_PANELS];
+
+static int failures;
+
+// The next free slot in a panel's queue, waiting for the driver if it's full
+static Command *beginCommand(Panel *panel, int type) {
+  uint32_t tail = panel->tail.load(std::memory_order_relaxed);
+  uint32_t full = tail - queueSlots;
+  if (panel->head.load(std::memory_order_acquire) == full) {
+    panel->stalls++;
+    while (panel->head.load(std::memory_order_acquire) == full)
+      std::this_thread::yield();
+  }
+  Command *command = &panel->slots[tail % queueSlots];
+  command->type = type;
+  return command;
+}
+
+// Hand the command written to the driver
+static void endCommand(Panel *panel) {
+  panel->tail.store(panel->tail.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+  panel->commands++;
+}
+
+static void sendToAllPanels(int type) {
+  for (int i = 0; i < panelCount; i++) {
+    beginCommand(panels[i], type);
+    endCommand(panels[i]);
+  }
+}
+
+static void sendRect(int type, int16_t x, int16_t y, int16_t width,
+                     int16_t height) {
+  // The panel map gives each panel's part of a rectangle separately
+  Panel *panel = panels[x / panelWidth];
+  Command *command = beginCommand(panel, type);
+  command->x = x % panelWidth;
+  command->y = y;
+  command->width = width;
+  command->height = height;
+  endCommand(panel);
+}
+
+// The wall decoder's callbacks, which send commands to the panels
+
+static void screenClearCallback(void) { sendToAllPanels(COMMAND_CLEAR); }
+
+static void drawLineCallback(int16_t x, int16_t y, uint8_t *buf, int16_t wid,
+                             rgb_24 *palette, int16_t skip) {
+  // Lines are split at panel edges, so this one is on a single panel.  It's
+  // sent as runs of the pixels that aren't transparent
+  Panel *panel = panels[x / panelWidth];
+  x %= panelWidth;
+  int i = 0;
+  while (i < wid) {
+    while (i < wid && buf[i] == skip)
+      i++;
+    int start = i;
+    while (i < wid && buf[i] != skip)
+      i++;
+    if (i == start)
+      continue;
+    Command *command = beginCommand(panel, COMMAND_PIXELS);
+    command->x = x + start;
+    command->y = y;
+    command->width = i - start;
+    for (int j = start; j < i; j++)
+      command->pixels[j - start] = palette[buf[j]];
+    endCommand(panel);
+  }
+}
+
+static bool saveRectCallback(int16_t x, int16_t y, int16_t width,
+                             int16_t height) {
+  sendRect(COMMAND_SAVE, x, y, width, height);
+  return true;
+}
+
+static void restoreRectCallback(int16_t x, int16_t y, int16_t width,
+                                int16_t height) {
+  sendRect(COMMAND_RESTORE, x, y, width, height);
+}
+
+// FNV-1a hash of a rectangle of rgb_24 pixels
+static uint32_t hashPixels(const rgb_24 *pixels, int stride, int width,
+                           int height) {
+  uint32_t hash = 2166136261UL;
+  for (int y = 0; y < height; y++) {
+    const uint8_t *p = (const uint8_t *)(pixels + y * stride);
+    for (int i = 0; i < width * 3; i++)
+      hash = (hash ^ p[i]) * 16777619UL;
+  }
+  return hash;
+}
+
+static void copyRect(rgb_24 *dst, const rgb_24 *src, int stride, int x, int y,
+                     int width, int height) {
+  for (int row = y; row < y + height; row++)
+    memcpy(dst + row * stride + x, src + row * stride + x,
+           width * sizeof(rgb_24));
+}
+
+static void runDriver(Panel *panel) {
+  int idle = 0;
+  for (;;) {
+    uint32_t head = panel->head.load(std::memory_order_relaxed);
+    if (panel->tail.load(std::memory_order_acquire) == head) {
+      if (++idle < DRIVER_SPINS)
+        std::this_thread::yield();
+      else
+        std::this_thread::sleep_for(
+            std::chrono::microseconds(DRIVER_SLEEP_MICROS));
+      continue;
+    }
+    idle = 0;
+    const Command *command = &panel->slots[head % queueSlots];
+    switch (command->type) {
+    case COMMAND_PIXELS:
+      memcpy(panel->screen + command->y * PANEL_MAX_WIDTH + command->x,
+             command->pixels, command->width * sizeof(rgb_24));
+      break;
+    case COMMAND_CLEAR:
+      memset(panel->screen, 0, sizeof(panel->screen));
+      break;
+    case COMMAND_SAVE:
+      copyRect(panel->saved, panel->screen, PANEL_MAX_WIDTH, command->x,
+               command->y, command->width, command->height);
+      break;
+    case COMMAND_RESTORE:
+      copyRect(panel->screen, panel->saved, PANEL_MAX_WIDTH, command->x,
+               command->y, command->width, command->height);
+      break;
+    case COMMAND_FRAME:
+      panel->frames.push_back(
+          hashPixels(panel->screen, PANEL_MAX_WIDTH, panelWidth, panelHeight));
+      break;
+    }
+    panel->head.store(head + 1, std::memory_order_release);
+    if (command->type == COMMAND_STOP)
+      return;
+  }
+}
+
+// The reference decoder's callbacks, drawing the whole wall
+
+static void wallClearCallback(void) { memset(wall, 0, sizeof(wall)); }
+
+static void wallLineCallback(int16_t x, int16_t y, uint8_t *buf, int16_t wid,
+                             rgb_24 *palette, int16_t skip) {
+  rgb_24 *p = wall + y * WALL_MAX_WIDTH + x;
+  for (int i = 0; i < wid; i++) {
+    if (buf[i] != skip)
+      p[i] = palette[buf[i]];
+  }
+}
+
+static bool wallSaveRectCallback(int16_t x, int16_t y, int16_t width,
+                                 int16_t height) {
+  copyRect(wallSaved, wall, WALL_MAX_WIDTH, x, y, width, height);
+  return true;
+}
+
+static void wallRestoreRectCallback(int16_t x, int16_t y, int16_t width,
+                                    int16_t height) {
+  copyRect(wall, wallSaved, WALL_MAX_WIDTH, x, y, width, height);
+}
+
+static void nullLineCallback(int16_t x, int16_t y, uint8_t *buf, int16_t wid,
+                             rgb_24 *palette, int16_t skip) {}
+
+static void setFileCallbacks(
+    GifDecoder<WALL_MAX_WIDTH, WALL_MAX_HEIGHT, 12, GIF_PIXEL_RGB24> &d) {
+  d.setFileSeekCallback(fileSeekCallback);
+  d.setFilePositionCallback(filePositionCallback);
+  d.setFileReadCallback(fileReadCallback);
+  d.setFileReadBlockCallback(fileReadBlockCallback);
+}
+
+// Decode one pass of the GIF for the wall, with a driver per panel.  Returns
+// the frame count, or the error
+static int decodeFanOut(double *ms) {
+  for (int i = 0; i < panelCount; i++) {
+    Panel *panel = panels[i];
+    panel->head = 0;
+    panel->tail = 0;
+    panel->commands = 0;
+    panel->stalls = 0;
+    panel->frames.clear();
+    memset(panel->screen, 0, sizeof(panel->screen));
+  }
+
+  uint32_t start = hostNanos();
+  for (int i = 0; i < panelCount; i++)
+    panels[i]->driver = std::thread(runDriver, panels[i]);
+  int frames = 0;
+  int result = decoder.startDecoding();
+  if (result >= 0) {
+    while ((result = decoder.decodeFrame(false)) == ERROR_NONE) {
+      sendToAllPanels(COMMAND_FRAME);
+      frames++;
+    }
+  }
+  sendToAllPanels(COMMAND_STOP);
+  for (int i = 0; i < panelCount; i++)
+    panels[i]->driver.join();
+  *ms = (hostNanos() - start) / 1e6;
+  return result < 0 ? result : frames;
+}
+
+// Decode one pass for the whole wall, recording each panel's frames
+static void decodeReference(void) {
+  memset(wall, 0, sizeof(wall));
+  for (int i = 0; i < panelCount; i++)
+    wallFrames[i].clear();
+  reference.setViewport(0, 0, columns * panelWidth, rows * panelHeight);
+  reference.setDrawLineCallback(wallLineCallback);
+  reference.setScreenClearCallback(wallClearCallback);
+  reference.setSaveRectCallback(wallSaveRectCallback);
+  reference.setRestoreRectCallback(wallRestoreRectCallback);
+  if (reference.startDecoding() < 0)
+    return;
+  while (reference.decodeFrame(false) == ERROR_NONE) {
+    for (int i = 0; i < panelCount; i++) {
+      const rgb_24 *p = wall + (i / columns) * panelHeight * WALL_MAX_WIDTH +
+                        (i % columns) * panelWidth;
+      wallFrames[i].push_back(
+          hashPixels(p, WALL_MAX_WIDTH, panelWidth, panelHeight));
+    }
+  }
+}
+
+// Decode one pass once per panel, with the panel's viewport
+static double decodePerPanel(void) {
+  reference.setDrawLineCallback(nullLineCallback);
+  reference.setScreenClearCallback(NULL);
+  reference.setSaveRectCallback(NULL);
+  reference.setRestoreRectCallback(NULL);
+  uint32_t start = hostNanos();
+  for (int i = 0; i < panelCount; i++) {
+    reference.setViewport((i % columns) * panelWidth,
+                          (i / columns) * panelHeight, panelWidth, panelHeight);
+    if (reference.startDecoding() < 0)
+      break;
+    while (reference.decodeFrame(false) == ERROR_NONE)
+      ;
+  }
+  return (hostNanos() - start) / 1e6;
+}
+
+static void wallFile(const char *pathname) {
+  const char *name = strrchr(pathname, '/');
+  name = name ? name + 1 : pathname;
+  if (openGifFile(pathname) < 0) {
+    printf("%-24s can't read the file\n", name);
+    failures++;
+    return;
+  }
+
+  double fanOutMs;
+  int frames = decodeFanOut(&fanOutMs);
+  if (frames <= 0) {
+    printf("%-24s error %d\n", name, frames);
+    failures++;
+    return;
+  }
+  decodeReference();
+  double perPanelMs = decodePerPanel();
+
+  unsigned long commands = 0;
+  unsigned long stalls = 0;
+  bool match = true;
+  for (int i = 0; i < panelCount; i++) {
+    commands += panels[i]->commands;
+    stalls += panels[i]->stalls;
+    match &= panels[i]->frames == wallFrames[i];
+  }
+  printf("%-24s %4d frames %3d panels %8.2f ms fan-out %8.2f ms per panel "
+         "%8lu commands %5lu stalls  %s\n",
+         name, frames, panelCount, fanOutMs, perPanelMs, commands, stalls,
+         match ? "ok" : "MISMATCH");
+  if (!match)
+    failures++;
+}
+
+int main(int argc, char **argv) {
+  bool usage = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:g:q:")) != -1) {
+    switch (opt) {
+    case 'p':
+      usage |= sscanf(optarg, "%dx%d", &panelWidth, &panelHeight) != 2;
+      break;
+    case 'g':
+      usage |= sscanf(optarg, "%dx%d", &columns, &rows) != 2;
+      break;
+    case 'q':
+      queueSlots = atoi(optarg);
+      break;
+    default:
+      usage = true;
+      break;
+    }
+  }
+  panelCount = columns * rows;
+  if (usage || optind >= argc || panelWidth < 1 ||
+      panelWidth > PANEL_MAX_WIDTH || panelHeight < 1 ||
+      panelHeight > PANEL_MAX_HEIGHT || columns < 1 || rows < 1 ||
+      panelCount > WALL_MAX_PANELS || columns * panelWidth > WALL_MAX_WIDTH ||
+      rows * panelHeight > WALL_MAX_HEIGHT || queueSlots < 1) {
+    fprintf(stderr,
+            "usage: %s [-p widthxheight] [-g columnsxrows] [-q slots] "
+            "file.gif|directory...\n"
+            "  -p  panel size, up to %dx%d (default 32x32)\n"
+            "  -g  panels across and down the wall, up to %d panels and "
+            "%dx%d\n"
+            "     pixels (default 2x2)\n"
+            "  -q  commands each panel's queue holds (default 256)\n",
+            argv[0], PANEL_MAX_WIDTH, PANEL_MAX_HEIGHT, WALL_MAX_PANELS,
+            WALL_MAX_WIDTH, WALL_MAX_HEIGHT);
+    return 1;
+  }
+
+  // The panels are chained in the order they're numbered, left to right and
+  // top to bottom
+  for (int i = 0; i < panelCount; i++) {
+    panels[i] = new Panel();
+    panels[i]->slots.resize(queueSlots);
+    panelMap[i] = i;
+  }
+
+  setFileCallbacks(decoder);
+  decoder.setViewport(0, 0, columns * panelWidth, rows * panelHeight);
+  decoder.setPanelMap(panelWidth, panelHeight, panelMap);
+  decoder.setDrawLineCallback(drawLineCallback);
+  decoder.setScreenClearCallback(screenClearCallback);
+  decoder.setSaveRectCallback(saveRectCallback);
+  decoder.setRestoreRectCallback(restoreRectCallback);
+  setFileCallbacks(reference);
+
+  forEachGifFile(argc - optind, argv + optind, wallFile);
+  return failures ? 1 : 0;
+}
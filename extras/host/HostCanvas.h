@@ -0,0 +1,90 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * A canvas for host tools that rewrite GIFs: the decoder draws each frame into
+ * it with the pixel callback, and the tool compares it with the frame before
+ * to find what changed.  Include after HostFileFunctions.h
+ */
+
+#ifndef HOST_CANVAS_H
+#define HOST_CANVAS_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define CANVAS_MAX_WIDTH 1024
+#define CANVAS_MAX_HEIGHT 1024
+
+// The frame as drawn by the decoder, and the one before it, as 0xRRGGBB
+static uint32_t canvas[CANVAS_MAX_WIDTH * CANVAS_MAX_HEIGHT];
+static uint32_t previous[CANVAS_MAX_WIDTH * CANVAS_MAX_HEIGHT];
+
+// Pixels of the changed rectangle that changed, row by row
+static uint8_t pending[CANVAS_MAX_WIDTH * CANVAS_MAX_HEIGHT];
+
+static void screenClearCallback(void) { memset(canvas, 0, sizeof(canvas)); }
+
+static void drawPixelCallback(int16_t x, int16_t y, uint8_t red, uint8_t green,
+                              uint8_t blue) {
+  if (x < 0 || y < 0 || x >= CANVAS_MAX_WIDTH || y >= CANVAS_MAX_HEIGHT)
+    return;
+  canvas[y * CANVAS_MAX_WIDTH + x] = (red << 16) | (green << 8) | blue;
+}
+
+static inline uint32_t canvasPixel(int x, int y) {
+  return canvas[y * CANVAS_MAX_WIDTH + x];
+}
+
+// Find the rectangle of pixels that changed since the previous frame, or the
+// whole screen if all is set, and mark the changed ones in pending.  The
+// rectangle is empty if nothing changed.  The canvas is then kept as the
+// previous frame
+static void findChangedRect(int width, int height, bool all, int *rectX,
+                            int *rectY, int *rectWidth, int *rectHeight) {
+  int x0 = width, y0 = height, x1 = -1, y1 = -1;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      int i = y * CANVAS_MAX_WIDTH + x;
+      if (all || canvas[i] != previous[i]) {
+        if (x < x0)
+          x0 = x;
+        if (x > x1)
+          x1 = x;
+        if (y0 > y)
+          y0 = y;
+        y1 = y;
+      }
+    }
+  }
+  if (x1 < 0) {
+    x0 = y0 = 0;
+    x1 = y1 = -1;
+  }
+  int w = x1 - x0 + 1;
+  int h = y1 - y0 + 1;
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      int i = (y0 + y) * CANVAS_MAX_WIDTH + x0 + x;
+      pending[y * w + x] = all || canvas[i] != previous[i];
+    }
+  }
+  memcpy(previous, canvas, sizeof(canvas));
+  *rectX = x0;
+  *rectY = y0;
+  *rectWidth = w;
+  *rectHeight = h;
+}
+
+// Loop count from the NETSCAPE2.0 application extension of the file in
+// memory, 0 (forever) if there isn't one
+static uint16_t findLoopCount(void) {
+  static const char netscape[] = "NETSCAPE2.0";
+  for (unsigned long i = 0; i + 15 <= fileSize; i++) {
+    if (memcmp(fileData + i, netscape, 11) == 0 && fileData[i + 11] == 3 &&
+        fileData[i + 12] == 1)
+      return fileData[i + 13] | (fileData[i + 14] << 8);
+  }
+  return 0;
+}
+
+#endif
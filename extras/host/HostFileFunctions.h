@@ -0,0 +1,115 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * File callbacks for host builds: the whole GIF is loaded into memory so that
+ * file I/O doesn't get in the way of timing the decoder.  The same four
+ * callbacks as the sketches' FilenameFunctions are provided.  The functions are
+ * static inline so a tool that doesn't use all of them builds clean with -Wall.
+ */
+
+#ifndef HOST_FILE_FUNCTIONS_H
+#define HOST_FILE_FUNCTIONS_H
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A tool decoding files on several threads defines this as static
+// thread_local, so each thread has a file of its own
+#ifndef HOST_FILE_STORAGE
+#define HOST_FILE_STORAGE static
+#endif
+
+HOST_FILE_STORAGE uint8_t *fileData;
+HOST_FILE_STORAGE unsigned long fileSize;
+HOST_FILE_STORAGE unsigned long filePosition;
+
+// I/O statistics, reset when a file is opened
+HOST_FILE_STORAGE unsigned long fileBytesRead;
+HOST_FILE_STORAGE unsigned long fileSeeks;
+
+static inline bool fileSeekCallback(unsigned long position) {
+  fileSeeks++;
+  if (position > fileSize)
+    return false;
+  filePosition = position;
+  return true;
+}
+
+static inline unsigned long filePositionCallback(void) {
+  return filePosition;
+}
+
+static inline int fileReadCallback(void) {
+  if (filePosition >= fileSize)
+    return -1;
+  fileBytesRead++;
+  return fileData[filePosition++];
+}
+
+static inline int fileReadBlockCallback(void *buffer, int numberOfBytes) {
+  if (filePosition >= fileSize)
+    return -1;
+  unsigned long n = fileSize - filePosition;
+  if ((unsigned long)numberOfBytes < n)
+    n = numberOfBytes;
+  memcpy(buffer, fileData + filePosition, n);
+  filePosition += n;
+  fileBytesRead += n;
+  return (int)n;
+}
+
+// Load a file into memory, returns -1 if it can't be read
+static inline int openGifFile(const char *pathname) {
+  FILE *f = fopen(pathname, "rb");
+  if (!f)
+    return -1;
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  free(fileData);
+  fileData = (uint8_t *)malloc(size > 0 ? size : 1);
+  fileSize = fread(fileData, 1, size, f);
+  fclose(f);
+  filePosition = 0;
+  fileBytesRead = 0;
+  fileSeeks = 0;
+  return 0;
+}
+
+static inline bool isAnimationFile(const char *filename) {
+  int len = strlen(filename);
+  if (filename[0] == '_' || filename[0] == '~' || filename[0] == '.')
+    return false;
+  // .fgf is the pre-decoded fast playback format made by GifTranscode
+  return len > 4 && (strcasecmp(filename + len - 4, ".gif") == 0 ||
+                     strcasecmp(filename + len - 4, ".fgf") == 0);
+}
+
+// Call f for every argument that is a GIF file, and for every GIF file inside
+// arguments that are directories, in sorted order
+static inline void forEachGifFile(int argc, char **argv,
+                                  void (*f)(const char *)) {
+  for (int i = 0; i < argc; i++) {
+    struct dirent **entries;
+    int n = scandir(argv[i], &entries, NULL, alphasort);
+    if (n < 0) {
+      f(argv[i]);
+      continue;
+    }
+    for (int j = 0; j < n; j++) {
+      if (isAnimationFile(entries[j]->d_name)) {
+        char pathname[1024];
+        snprintf(pathname, sizeof(pathname), "%s/%s", argv[i],
+                 entries[j]->d_name);
+        f(pathname);
+      }
+      free(entries[j]);
+    }
+    free(entries);
+  }
+}
+
+#endif
@@ -0,0 +1,337 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * A C++20 coroutine that plays a GIF (or .fgf) as a lazy sequence of frames,
+ * for host programs that would rather pull frames than be called back:
+ *
+ *   for (const GifFrameView &frame : gifFrames(data, size))
+ *     show(frame.pixels, frame.dirtyX, ..., frame.delay_ms);
+ *
+ * Each generator has a decoder, file and canvas of its own, so any number can
+ * play at once, and a generator can be resumed on any thread (by one thread
+ * at a time), so a few threads can drive many animations.  The frame is
+ * yielded in place: it's valid until the generator is resumed.  Playing stops
+ * at the end of the file, when stop is requested, or at any frame by
+ * destroying the generator.
+ *
+ * Include after ArduinoShim.h and before GifDecoder.h, whose min() macro
+ * breaks the C++ headers this needs, and build with -std=c++20
+ */
+
+#ifndef HOST_GIF_FRAMES_H
+#define HOST_GIF_FRAMES_H
+
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <utility>
+#include <vector>
+
+#include <GifDecoder.h>
+
+// A frame of the animation: the whole canvas as RGB, stride bytes per row,
+// the rectangle of it that changed since the frame before, and how long the
+// frame is shown for
+struct GifFrameView {
+  const uint8_t *pixels;
+  int width;
+  int height;
+  int stride;
+  int dirtyX;
+  int dirtyY;
+  int dirtyWidth;
+  int dirtyHeight;
+  unsigned int delay_ms;
+  unsigned long frameNo;
+};
+
+// Just enough of a generator to iterate over the values a coroutine yields
+template <typename T> class HostGenerator {
+public:
+  struct promise_type {
+    const T *value;
+
+    HostGenerator get_return_object() {
+      return HostGenerator(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    std::suspend_always yield_value(const T &v) noexcept {
+      value = &v;
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() { throw; }
+  };
+
+  HostGenerator(HostGenerator &&other) noexcept
+      : handle(std::exchange(other.handle, nullptr)) {}
+  HostGenerator &operator=(HostGenerator &&other) noexcept {
+    if (this != &other) {
+      if (handle)
+        handle.destroy();
+      handle = std::exchange(other.handle, nullptr);
+    }
+    return *this;
+  }
+  ~HostGenerator() {
+    if (handle)
+      handle.destroy();
+  }
+
+  // Run to the next value, false once there are no more
+  bool next() {
+    if (!handle || handle.done())
+      return false;
+    handle.resume();
+    return !handle.done();
+  }
+  const T &value() const { return *handle.promise().value; }
+
+  class iterator {
+  public:
+    explicit iterator(HostGenerator *g) : generator(g) {}
+    const T &operator*() const { return generator->value(); }
+    iterator &operator++() {
+      if (!generator->next())
+        generator = nullptr;
+      return *this;
+    }
+    bool operator==(std::default_sentinel_t) const { return !generator; }
+
+  private:
+    HostGenerator *generator;
+  };
+
+  iterator begin() { return iterator(next() ? this : nullptr); }
+  std::default_sentinel_t end() { return {}; }
+
+private:
+  explicit HostGenerator(std::coroutine_handle<promise_type> h) : handle(h) {}
+  std::coroutine_handle<promise_type> handle;
+};
+
+// Everything a generator's decoder draws with and reads from
+struct HostFrameSource {
+  const uint8_t *data;
+  unsigned long size;
+  unsigned long position;
+  int width;
+  int height;
+  std::vector<uint8_t> canvas;
+  // The rectangle saved for a disposal method 3 frame
+  std::vector<uint8_t> saved;
+  // What's been drawn on since the last frame, x1/y1 exclusive
+  int dirtyX0, dirtyY0, dirtyX1, dirtyY1;
+};
+
+// How many generators can play at once.  The decoder's callbacks have no
+// argument to find a generator's source with, so each generator has a slot,
+// and callbacks made for that slot which read its source from this table.  A
+// generator started while every slot is in use plays no frames
+#ifndef HOST_FRAME_SOURCES
+#define HOST_FRAME_SOURCES 256
+#endif
+
+static HostFrameSource *frameSources[HOST_FRAME_SOURCES];
+static std::mutex frameSourcesLock;
+
+template <int slot> struct HostFrameCallbacks {
+  static void markDirty(int x0, int y0, int x1, int y1) {
+    HostFrameSource *s = frameSources[slot];
+    if (x0 < s->dirtyX0)
+      s->dirtyX0 = x0;
+    if (y0 < s->dirtyY0)
+      s->dirtyY0 = y0;
+    if (x1 > s->dirtyX1)
+      s->dirtyX1 = x1;
+    if (y1 > s->dirtyY1)
+      s->dirtyY1 = y1;
+  }
+
+  static bool seek(unsigned long position) {
+    HostFrameSource *s = frameSources[slot];
+    if (position > s->size)
+      return false;
+    s->position = position;
+    return true;
+  }
+
+  static unsigned long position(void) { return frameSources[slot]->position; }
+
+  static int read(void) {
+    HostFrameSource *s = frameSources[slot];
+    if (s->position >= s->size)
+      return -1;
+    return s->data[s->position++];
+  }
+
+  static int readBlock(void *buffer, int numberOfBytes) {
+    HostFrameSource *s = frameSources[slot];
+    if (s->position >= s->size)
+      return -1;
+    unsigned long n = s->size - s->position;
+    if ((unsigned long)numberOfBytes < n)
+      n = numberOfBytes;
+    memcpy(buffer, s->data + s->position, n);
+    s->position += n;
+    return (int)n;
+  }
+
+  static void clear(void) {
+    HostFrameSource *s = frameSources[slot];
+    memset(s->canvas.data(), 0, s->canvas.size());
+    markDirty(0, 0, s->width, s->height);
+  }
+
+  static void span(int16_t x, int16_t y, int16_t len, uint8_t red,
+                   uint8_t green, uint8_t blue) {
+    HostFrameSource *s = frameSources[slot];
+    if (y < 0 || y >= s->height)
+      return;
+    int start = x < 0 ? 0 : x;
+    int end = min(x + len, s->width);
+    if (start >= end)
+      return;
+    uint8_t *p = s->canvas.data() + (y * s->width + start) * 3;
+    for (int i = start; i < end; i++) {
+      *p++ = red;
+      *p++ = green;
+      *p++ = blue;
+    }
+    markDirty(start, y, end, y + 1);
+  }
+
+  static void pixel(int16_t x, int16_t y, uint8_t red, uint8_t green,
+                    uint8_t blue) {
+    span(x, y, 1, red, green, blue);
+  }
+
+  // Disposal method 3 with NO_IMAGEDATA == 2: a copy of the whole canvas size
+  // is kept, so the rectangle can always be saved
+  static bool saveRect(int16_t x, int16_t y, int16_t width, int16_t height) {
+    HostFrameSource *s = frameSources[slot];
+    for (int row = y; row < y + height; row++) {
+      int offset = (row * s->width + x) * 3;
+      memcpy(s->saved.data() + offset, s->canvas.data() + offset, width * 3);
+    }
+    return true;
+  }
+
+  static void restoreRect(int16_t x, int16_t y, int16_t width,
+                          int16_t height) {
+    HostFrameSource *s = frameSources[slot];
+    for (int row = y; row < y + height; row++) {
+      int offset = (row * s->width + x) * 3;
+      memcpy(s->canvas.data() + offset, s->saved.data() + offset, width * 3);
+    }
+    markDirty(x, y, x + width, y + height);
+  }
+
+  template <typename Decoder> static void set(Decoder &decoder) {
+    decoder.setScreenClearCallback(clear);
+    decoder.setDrawPixelCallback(pixel);
+    decoder.setDrawSpanCallback(span);
+    decoder.setSaveRectCallback(saveRect);
+    decoder.setRestoreRectCallback(restoreRect);
+    decoder.setFileSeekCallback(seek);
+    decoder.setFilePositionCallback(position);
+    decoder.setFileReadCallback(read);
+    decoder.setFileReadBlockCallback(readBlock);
+  }
+};
+
+// Set the decoder's callbacks to slot's
+template <typename Decoder, int... slots>
+static void setFrameCallbacks(Decoder &decoder, int slot,
+                              std::integer_sequence<int, slots...>) {
+  ((slot == slots ? HostFrameCallbacks<slots>::set(decoder) : void()), ...);
+}
+
+// A slot for source to play in, while the generator holding it lives
+class HostFrameSlot {
+public:
+  explicit HostFrameSlot(HostFrameSource *source) {
+    std::lock_guard<std::mutex> guard(frameSourcesLock);
+    for (int i = 0; i < HOST_FRAME_SOURCES; i++) {
+      if (!frameSources[i]) {
+        frameSources[i] = source;
+        slot = i;
+        break;
+      }
+    }
+  }
+  ~HostFrameSlot() {
+    std::lock_guard<std::mutex> guard(frameSourcesLock);
+    if (slot >= 0)
+      frameSources[slot] = NULL;
+  }
+  HostFrameSlot(const HostFrameSlot &) = delete;
+  HostFrameSlot &operator=(const HostFrameSlot &) = delete;
+
+  // -1 if every slot was in use
+  int number() const { return slot; }
+
+private:
+  int slot = -1;
+};
+
+// The frames of the GIF in data, which has to outlive the generator, played
+// once.  GIFs larger than maxWidth x maxHeight are cropped to it
+template <int maxWidth = 1024, int maxHeight = 1024>
+HostGenerator<GifFrameView> gifFrames(const uint8_t *data, unsigned long size,
+                                      std::stop_token stop = {}) {
+  HostFrameSource source = {};
+  source.data = data;
+  source.size = size;
+  HostFrameSlot slot(&source);
+  if (slot.number() < 0)
+    co_return;
+
+  // Zeroed like a static decoder would be, so the callbacks that aren't set
+  // are NULL
+  auto decoder = std::make_unique<GifDecoder<maxWidth, maxHeight, 12>>();
+  setFrameCallbacks(*decoder, slot.number(),
+                    std::make_integer_sequence<int, HOST_FRAME_SOURCES>());
+  if (decoder->startDecoding() < 0)
+    co_return;
+
+  uint16_t width, height;
+  decoder->getSize(&width, &height);
+  source.width = min((int)width, maxWidth);
+  source.height = min((int)height, maxHeight);
+  // so nothing is drawn outside of the canvas
+  decoder->setViewport(0, 0, source.width, source.height);
+  source.canvas.assign(source.width * source.height * 3, 0);
+  source.saved.assign(source.canvas.size(), 0);
+
+  GifFrameView frame = {};
+  frame.pixels = source.canvas.data();
+  frame.width = source.width;
+  frame.height = source.height;
+  frame.stride = source.width * 3;
+  while (!stop.stop_requested()) {
+    source.dirtyX0 = source.width;
+    source.dirtyY0 = source.height;
+    source.dirtyX1 = source.dirtyY1 = 0;
+    // ERROR_DONE_PARSING at the end of the file, or an error
+    if (decoder->decodeFrame(false) != ERROR_NONE)
+      break;
+
+    frame.dirtyX = source.dirtyX0;
+    frame.dirtyY = source.dirtyY0;
+    frame.dirtyWidth = source.dirtyX1 - source.dirtyX0;
+    frame.dirtyHeight = source.dirtyY1 - source.dirtyY0;
+    if (frame.dirtyWidth <= 0 || frame.dirtyHeight <= 0)
+      frame.dirtyX = frame.dirtyY = frame.dirtyWidth = frame.dirtyHeight = 0;
+    frame.delay_ms = decoder->getFrameDelay_ms();
+    frame.frameNo = decoder->getFrameNo();
+    co_yield frame;
+  }
+}
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * LZW encoder for host tools that write GIF image data.  lzwEncode() leaves
+ * the minimum code size byte, the sub-blocks and the empty block that ends
+ * them in lzwData.
+ */
+
+#ifndef HOST_LZW_ENCODER_H
+#define HOST_LZW_ENCODER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// clearInterval for lzwEncode(): never clear, keep coding with the full table
+#define LZW_NO_CLEAR -1
+
+static uint8_t *lzwData;
+static unsigned long lzwDataSize;
+static unsigned long lzwDataCapacity;
+
+// Codes written by the last lzwEncode(), including clear and end codes
+static unsigned long lzwCodeCount;
+
+static uint16_t lzwChild[4096 * 256]; // code for code + pixel, 0 if none
+static uint32_t lzwInserted[4096];    // lzwChild entries to clear on reset
+static int lzwInsertedCount;
+static uint32_t lzwBitBuffer;
+static int lzwBitCount;
+static uint8_t lzwBlock[255];
+static int lzwBlockLen;
+static int lzwBlockSize;
+
+static void lzwPut(const void *data, unsigned long len) {
+  if (lzwDataSize + len > lzwDataCapacity) {
+    lzwDataCapacity = (lzwDataSize + len) * 2;
+    lzwData = (uint8_t *)realloc(lzwData, lzwDataCapacity);
+  }
+  memcpy(lzwData + lzwDataSize, data, len);
+  lzwDataSize += len;
+}
+
+static void lzwPutByte(uint8_t b) { lzwPut(&b, 1); }
+
+static void lzwWriteCode(int code, int codeSize) {
+  lzwBitBuffer |= (uint32_t)code << lzwBitCount;
+  lzwBitCount += codeSize;
+  while (lzwBitCount >= 8) {
+    lzwBlock[lzwBlockLen++] = lzwBitBuffer & 0xff;
+    lzwBitBuffer >>= 8;
+    lzwBitCount -= 8;
+    if (lzwBlockLen == lzwBlockSize) {
+      lzwPutByte(lzwBlockSize);
+      lzwPut(lzwBlock, lzwBlockSize);
+      lzwBlockLen = 0;
+    }
+  }
+}
+
+static void lzwReset(void) {
+  for (int i = 0; i < lzwInsertedCount; i++)
+    lzwChild[lzwInserted[i]] = 0;
+  lzwInsertedCount = 0;
+}
+
+// Encode count pixels with codes of up to maxBits bits, in sub-blocks of
+// blockSize bytes (1-255, the last one may be shorter).  The table is cleared
+// when it's full, and also after every clearInterval codes if that's > 0
+static void lzwEncode(const uint8_t *pixels, int count, int minCodeSize,
+                      int maxBits, int blockSize = 255,
+                      int clearInterval = 0) {
+  int clearCode = 1 << minCodeSize;
+  int codeSize = minCodeSize + 1;
+  int nextCode = clearCode + 2;
+  int codesSinceClear = 0;
+
+  lzwDataSize = 0;
+  lzwCodeCount = 0;
+  lzwPutByte(minCodeSize);
+  lzwBitBuffer = 0;
+  lzwBitCount = 0;
+  lzwBlockLen = 0;
+  lzwBlockSize = blockSize;
+  lzwReset();
+  lzwWriteCode(clearCode, codeSize);
+  lzwCodeCount++;
+
+  int prefix = pixels[0];
+  for (int i = 1; i < count; i++) {
+    uint32_t key = prefix * 256 + pixels[i];
+    if (lzwChild[key]) {
+      prefix = lzwChild[key];
+      continue;
+    }
+    lzwWriteCode(prefix, codeSize);
+    lzwCodeCount++;
+    codesSinceClear++;
+    if (nextCode < (1 << maxBits)) {
+      lzwChild[key] = nextCode++;
+      lzwInserted[lzwInsertedCount++] = key;
+      // The decoder adds each code one code later than this, so it widens
+      // codes when the last code added no longer fits
+      if (nextCode - 1 >= (1 << codeSize))
+        codeSize++;
+    }
+    if ((nextCode == (1 << maxBits) && clearInterval != LZW_NO_CLEAR) ||
+        (clearInterval > 0 && codesSinceClear >= clearInterval)) {
+      lzwWriteCode(clearCode, codeSize);
+      lzwCodeCount++;
+      lzwReset();
+      codeSize = minCodeSize + 1;
+      nextCode = clearCode + 2;
+      codesSinceClear = 0;
+    }
+    prefix = pixels[i];
+  }
+  lzwWriteCode(prefix, codeSize);
+  lzwWriteCode(clearCode + 1, codeSize);
+  lzwCodeCount += 2;
+  if (lzwBitCount > 0)
+    lzwWriteCode(0, 8 - lzwBitCount);
+  if (lzwBlockLen > 0) {
+    lzwPutByte(lzwBlockLen);
+    lzwPut(lzwBlock, lzwBlockLen);
+  }
+  lzwPutByte(0);
+}
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * The worker threads GifBatch and GifFrames share out their jobs on, a job
+ * being an index into the tool's own list of work.  Each worker has a queue of
+ * its own, which it takes from the front of, and a worker with none left takes
+ * the last job of another's.  A job can queue more jobs before it's done, and
+ * the workers stop once every queue is empty and no job is running:
+ *
+ *   int job;
+ *   while (pool.take(n, &job)) {
+ *     ...
+ *     pool.done();
+ *   }
+ *
+ * Include after ArduinoShim.h and before GifDecoder.h, whose min() macro
+ * breaks the C++ headers this needs
+ */
+
+#ifndef HOST_WORKER_POOL_H
+#define HOST_WORKER_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class HostWorkerPool {
+public:
+  explicit HostWorkerPool(int workers) : queues(workers) {}
+
+  int size() const { return (int)queues.size(); }
+
+  // Add a job to the back of worker n's queue
+  void push(int n, int job) {
+    std::lock_guard<std::mutex> guard(lock);
+    queues[n].push_back(job);
+    wake.notify_one();
+  }
+
+  // The next job for worker n: its own first, then the last of another's.
+  // Waits while there are none queued but some running, as they may queue
+  // more, and returns false once there are none of either
+  bool take(int n, int *job) {
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+      for (size_t i = 0; i < queues.size(); i++) {
+        std::deque<int> &queue = queues[(n + i) % queues.size()];
+        if (queue.empty())
+          continue;
+        if (i == 0) {
+          *job = queue.front();
+          queue.pop_front();
+        } else {
+          *job = queue.back();
+          queue.pop_back();
+        }
+        running++;
+        return true;
+      }
+      if (running == 0)
+        return false;
+      wake.wait(guard);
+    }
+  }
+
+  // Call when the job take() returned is finished
+  void done() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (--running == 0)
+      wake.notify_all();
+  }
+
+  // Run body(n) on a thread for each worker n, and wait for them all
+  template <typename F> void run(F body) {
+    std::vector<std::thread> threads;
+    for (int n = 0; n < size(); n++)
+      threads.emplace_back(body, n);
+    for (std::thread &thread : threads)
+      thread.join();
+  }
+
+private:
+  std::mutex lock;
+  std::condition_variable wake;
+  std::vector<std::deque<int>> queues;
+  int running = 0;
+};
+
+#endif
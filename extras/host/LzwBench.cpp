@@ -0,0 +1,204 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * Microbenchmark for the LZW decoder on its own, with image data the sample
+ * GIFs don't cover.  Synthetic 256x256 images are encoded with HostLzwEncoder.h
+ * and decoded a line at a time with lzw_decode_init() and lzw_decode(), like
+ * the decoder does, reporting ns per code and per pixel.  The cases vary:
+ *  - the initial code size, 2 to 8 bits
+ *  - the image: random pixels (strings of one or two pixels), random runs of
+ *    1-16 pixels, a repeated 8x8 tile, and one color (the longest strings)
+ *  - how often the table is cleared: when full, every 512 or 64 codes, or
+ *    never (codes keep using the full table)
+ *  - the sub-block size, including odd sizes and 1 byte blocks, which take the
+ *    odd byte fix-up and refill paths in lzw_decode()
+ * Each decoded image is checked against the one encoded before it's timed.
+ *
+ * Build and run from this directory:
+ *   c++ -O2 -Wall -I../../src -o lzwbench LzwBench.cpp
+ *   ./lzwbench [-n passes]
+ */
+
+#include "ArduinoShim.h"
+#include "HostFileFunctions.h"
+#include "HostLzwEncoder.h"
+
+#include <unistd.h>
+
+#define GIF_LZW_BENCHMARK
+#include <GifDecoder.h>
+
+#define BENCH_WIDTH 256
+#define BENCH_HEIGHT 256
+#define BENCH_PIXELS (BENCH_WIDTH * BENCH_HEIGHT)
+
+// Cases are timed for more passes, until they've taken this long
+#define MIN_TIMING_NANOS 20000000
+
+static GifDecoder<BENCH_WIDTH, BENCH_HEIGHT, 12> decoder;
+
+static uint8_t pixels[BENCH_PIXELS];
+static uint8_t line[BENCH_WIDTH];
+
+// Like the decoder's tempBuffer, a sub-block and the next block's size, at an
+// even address
+static uint16_t blockBuffer[130];
+
+static int passes = 10;
+static int failures;
+
+// The slowest case per pixel, to judge changes to the hot loop by
+static double slowestNsPerPixel;
+static char slowestCase[64];
+
+enum { IMAGE_NOISE, IMAGE_RUNS, IMAGE_TILE, IMAGE_FLAT };
+static const char *imageNames[] = {"noise", "runs", "tile", "flat"};
+
+// Reproducible random numbers, so each case decodes the same data every run
+static uint32_t randomState;
+
+static uint32_t nextRandom(void) {
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}
+
+static void makeImage(int image, int codeSize) {
+  int colors = 1 << codeSize;
+  randomState = 2463534242UL;
+  switch (image) {
+  case IMAGE_NOISE:
+    for (int i = 0; i < BENCH_PIXELS; i++)
+      pixels[i] = nextRandom() % colors;
+    break;
+  case IMAGE_RUNS:
+    for (int i = 0; i < BENCH_PIXELS;) {
+      int run = 1 + nextRandom() % 16;
+      uint8_t color = nextRandom() % colors;
+      for (; run > 0 && i < BENCH_PIXELS; run--)
+        pixels[i++] = color;
+    }
+    break;
+  case IMAGE_TILE: {
+    uint8_t tile[64];
+    for (int i = 0; i < 64; i++)
+      tile[i] = nextRandom() % colors;
+    for (int y = 0; y < BENCH_HEIGHT; y++) {
+      for (int x = 0; x < BENCH_WIDTH; x++)
+        pixels[y * BENCH_WIDTH + x] = tile[(y % 8) * 8 + x % 8];
+    }
+    break;
+  }
+  case IMAGE_FLAT:
+    memset(pixels, colors - 1, sizeof(pixels));
+    break;
+  }
+}
+
+// Decode the image data in fileData a line at a time, returns false if the
+// pixels don't match the image when check is set
+static bool decodeImage(int codeSize, bool check) {
+  filePosition = 0;
+  decoder.lzw_decode_init(codeSize);
+  decoder.lzw_setTempBuffer((uint8_t *)blockBuffer);
+  for (int y = 0; y < BENCH_HEIGHT; y++) {
+    int decoded = decoder.lzw_decode(line, BENCH_WIDTH, line + BENCH_WIDTH);
+    if (check && (decoded != BENCH_WIDTH ||
+                  memcmp(line, pixels + y * BENCH_WIDTH, BENCH_WIDTH) != 0))
+      return false;
+  }
+  return true;
+}
+
+static void benchmarkCase(int codeSize, int image, int clearInterval,
+                          int blockSize) {
+  makeImage(image, codeSize);
+  lzwEncode(pixels, BENCH_PIXELS, codeSize, 12, blockSize, clearInterval);
+
+  // The decoder reads from the first sub-block, after the code size.  A few
+  // bytes more, as it can read a little past the end of the data
+  free(fileData);
+  fileSize = lzwDataSize - 1 + 8;
+  fileData = (uint8_t *)calloc(fileSize, 1);
+  memcpy(fileData, lzwData + 1, lzwDataSize - 1);
+
+  char clear[16];
+  if (clearInterval == 0)
+    snprintf(clear, sizeof(clear), "full");
+  else if (clearInterval == LZW_NO_CLEAR)
+    snprintf(clear, sizeof(clear), "never");
+  else
+    snprintf(clear, sizeof(clear), "%d", clearInterval);
+  char name[64];
+  snprintf(name, sizeof(name), "%d-bit %-5s clear %-5s blocks %3d", codeSize,
+           imageNames[image], clear, blockSize);
+
+  if (!decodeImage(codeSize, true)) {
+    printf("%s  FAIL: decoded pixels don't match\n", name);
+    failures++;
+    return;
+  }
+
+  uint32_t best = 0;
+  uint64_t total = 0;
+  for (int pass = 0; pass < passes || total < MIN_TIMING_NANOS; pass++) {
+    uint32_t start = hostNanos();
+    decodeImage(codeSize, false);
+    uint32_t elapsed = hostNanos() - start;
+    if (pass == 0 || elapsed < best)
+      best = elapsed;
+    total += elapsed;
+  }
+
+  double nsPerPixel = (double)best / BENCH_PIXELS;
+  printf("%s  %6lu codes %6lu bytes  %6.2f ns/code %6.2f ns/pixel\n", name,
+         lzwCodeCount, lzwDataSize, (double)best / lzwCodeCount, nsPerPixel);
+  if (nsPerPixel > slowestNsPerPixel) {
+    slowestNsPerPixel = nsPerPixel;
+    snprintf(slowestCase, sizeof(slowestCase), "%s", name);
+  }
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+    case 'n':
+      passes = atoi(optarg);
+      break;
+    default:
+      passes = 0;
+      break;
+    }
+  }
+  if (optind < argc || passes < 1) {
+    fprintf(stderr, "usage: %s [-n passes]\n", argv[0]);
+    return 1;
+  }
+
+  decoder.setFileReadBlockCallback(fileReadBlockCallback);
+
+  printf("Code sizes\n");
+  for (int image = IMAGE_NOISE; image <= IMAGE_FLAT; image++) {
+    for (int codeSize = 2; codeSize <= 8; codeSize++)
+      benchmarkCase(codeSize, image, 0, 255);
+  }
+
+  printf("\nClear codes\n");
+  static const int clearIntervals[] = {0, 512, 64, LZW_NO_CLEAR};
+  for (int image = IMAGE_NOISE; image <= IMAGE_FLAT; image++) {
+    for (int clearInterval : clearIntervals)
+      benchmarkCase(8, image, clearInterval, 255);
+  }
+
+  printf("\nSub-block sizes\n");
+  static const int blockSizes[] = {255, 254, 31, 7, 2, 1};
+  for (int image = IMAGE_NOISE; image <= IMAGE_FLAT; image++) {
+    for (int blockSize : blockSizes)
+      benchmarkCase(8, image, 0, blockSize);
+  }
+
+  printf("\nSlowest: %s, %.2f ns/pixel\n", slowestCase, slowestNsPerPixel);
+  return failures ? 1 : 0;
+}
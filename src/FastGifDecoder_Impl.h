@@ -0,0 +1,332 @@
+/*
+ * Animated GIFs Display Code for SmartMatrix and 32x32 RGB LED Panels
+ *
+ * This file contains code to play the pre-decoded fast playback format
+ *
+ * A GIF is converted on a computer (see extras/host/GifTranscode.cpp) into
+ * frames that are already composed, so playing it back needs no LZW decoding
+ * and no disposal: each frame is a rectangle of palette indexes that changed
+ * since the previous frame, stored raw or run-length encoded, and drawn over
+ * the previous frame through the usual callbacks.  startDecoding() recognizes
+ * the format, so a sketch can play .gif and .fgf files the same way.
+ *
+ * All values are little-endian.  The file header is:
+ *    0  "FGIF"
+ *    4  version (1)
+ *    5  log2 of the alignment of the header and each record, so records can
+ *       start on sector boundaries (0 = not aligned)
+ *    6  width
+ *    8  height
+ *   10  number of frames
+ *   12  loop count from the GIF (0 = forever)
+ *   14  reserved
+ *
+ * Then for each frame one or more records, each padded to the alignment:
+ *    0  record size in bytes, including this header and the padding
+ *    4  flags, FASTGIF_xxx
+ *    5  transparent index, pixels with this value are not drawn (with
+ *       FASTGIF_TRANSPARENT)
+ *    6  frame delay in 1/100 s
+ *    8  x, y, width and height of the rectangle
+ *   16  number of palette entries that follow, 0 to keep the previous palette
+ *   18  reserved
+ *   20  palette, 3 bytes per entry
+ *       rows, either width bytes each, or with FASTGIF_RLE a series of
+ *       packets: a control byte c < 128 followed by c + 1 literal bytes, or
+ *       c >= 128 followed by one byte repeated c - 126 times
+ *
+ * A frame needing more than 256 colors is split into records flagged with
+ * FASTGIF_CONTINUED, the frame is shown after the last one.
+ *
+ * Frames are skipped like a GIF's: behind the timeline the frame's record
+ * headers are read first for its delay, so it can be resynced or dropped,
+ * and with duplicate frame skipping a frame that draws nothing (an empty
+ * rectangle, as GifTranscode writes for a frame that's the same as the one
+ * before) doesn't update the screen.
+ */
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#elif defined(SPARK)
+#include "application.h"
+#endif
+
+#include "GifDecoder.h"
+
+#define FASTGIF_MAGIC "FGIF"
+#define FASTGIF_MAGIC_SIZE 4
+#define FASTGIF_VERSION 1
+#define FASTGIF_HEADER_SIZE 16
+#define FASTGIF_RECORD_SIZE 20
+
+// Record flags
+#define FASTGIF_RLE 0x01
+#define FASTGIF_TRANSPARENT 0x02
+#define FASTGIF_CONTINUED 0x04
+
+static inline uint16_t fastGifWord(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+// Check for the fast format header, and get ready to play the first frame
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+bool GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::parseFastHeader(void) {
+  uint8_t *header = (uint8_t *)tempBuffer;
+
+  readIntoBuffer(header, FASTGIF_HEADER_SIZE);
+  if (strncmp((char *)header, FASTGIF_MAGIC, FASTGIF_MAGIC_SIZE) != 0 ||
+      header[4] != FASTGIF_VERSION) {
+    return false;
+  }
+  fastAlignShift = header[5];
+  lsdWidth = fastGifWord(header + 6);
+  lsdHeight = fastGifWord(header + 8);
+  fastFrameTotal = fastGifWord(header + 10);
+  // 0 loops forever, as a GIF with no loop count does
+  loopCount = fastGifWord(header + 12);
+  fastFirstRecord =
+      (FASTGIF_HEADER_SIZE + (1UL << fastAlignShift) - 1) >> fastAlignShift
+                                                          << fastAlignShift;
+  fastFrameIndex = 0;
+  fastFormat = true;
+  frameNo = 0;
+  frameCount = 0;
+  cycleNo = 1;
+  seekStream(fastFirstRecord);
+  return true;
+}
+
+// Read the next byte of the record, through tempBuffer
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+inline int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                      pixelFormat>::fastReadByte(void) {
+  if (fastBufPos == fastBufLen) {
+    fastRead(NULL, 0);
+  }
+  if (fastBufPos == fastBufLen) {
+    // past the end of the record
+    return 0;
+  }
+  return (uint8_t)tempBuffer[fastBufPos++];
+}
+
+// Read len bytes of the record into buf, or drop them if buf is NULL
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::fastRead(uint8_t *buf, int len) {
+  do {
+    if (fastBufPos == fastBufLen) {
+      if (fastRemaining == 0) {
+        // Bad data, don't leave garbage in buf
+        if (buf)
+          memset(buf, 0, len);
+        return;
+      }
+      fastBufLen = min(fastRemaining, (uint32_t)sizeof(tempBuffer));
+      readIntoBuffer(tempBuffer, fastBufLen);
+      fastRemaining -= fastBufLen;
+      fastBufPos = 0;
+    }
+    int n = min(len, fastBufLen - fastBufPos);
+    if (buf) {
+      memcpy(buf, tempBuffer + fastBufPos, n);
+      buf += n;
+    }
+    fastBufPos += n;
+    len -= n;
+  } while (len > 0);
+}
+
+// Decode one row of width pixels, storing the writable pixels after the first
+// align in buf
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
+    fastDecodeRow(uint8_t *buf, int width, int align, int writable, bool rle) {
+  int end = align + writable;
+  int x = 0;
+  while (x < width) {
+    int n = width - x;
+    int value = -1;
+    if (rle) {
+      int c = fastReadByte();
+      if (c < 128) {
+        n = min(n, c + 1);
+      } else {
+        n = min(n, c - 126);
+        value = fastReadByte();
+      }
+    }
+    // The part of the packet that's stored
+    int from = (x > align) ? x : align;
+    int to = (x + n < end) ? x + n : end;
+    if (value >= 0) {
+      if (from < to)
+        memset(buf + from - align, value, to - from);
+    } else if (from < to) {
+      fastRead(NULL, from - x);
+      fastRead(buf + from - align, to - from);
+      fastRead(NULL, x + n - to);
+    } else {
+      fastRead(NULL, n);
+    }
+    x += n;
+  }
+}
+
+// Draw the next frame, returns ERROR_DONE_PARSING and goes back to the first
+// frame after the last one, like parseData() at the end of a GIF, unless it
+// has played as many times as the loop count asks for
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+               pixelFormat>::decodeFastFrame(void) {
+  if (fastFrameIndex == fastFrameTotal) {
+    // The same check as startFrame() makes at the end of a GIF
+    if (loopCount > 0 && cycleNo > loopCount) {
+      finished = true;
+      return ERROR_DONE_PARSING;
+    }
+    fastFrameIndex = 0;
+    frameCount = frameNo;
+    frameNo = 0;
+    cycleNo++;
+    seekStream(fastFirstRecord);
+    return ERROR_DONE_PARSING;
+  }
+
+  uint8_t rowBuf[maxGifWidth];
+  uint8_t *record = (uint8_t *)tempBuffer;
+  uint8_t flags;
+
+  // Behind the timeline, read the frame's record headers for its delay and
+  // where it ends, to resync or drop it like parseTableBasedImage() does
+  unsigned long frameStart = filePositionCallback();
+  if ((int32_t)(micros() - (timelineEpoch + timelinePosition)) > 0) {
+    unsigned long frameEnd = frameStart;
+    unsigned long paletteRecord = 0;
+    int paletteCount = 0;
+    do {
+      seekStream(frameEnd);
+      readIntoBuffer(record, FASTGIF_RECORD_SIZE);
+      uint32_t recordSize =
+          fastGifWord(record) | (uint32_t)fastGifWord(record + 2) << 16;
+      if (recordSize < FASTGIF_RECORD_SIZE)
+        return ERROR_BADGIFFORMAT;
+      flags = record[4];
+      frameDelay = fastGifWord(record + 6);
+      if (fastGifWord(record + 16)) {
+        paletteRecord = frameEnd;
+        paletteCount = fastGifWord(record + 16);
+      }
+      frameEnd += recordSize;
+    } while (flags & FASTGIF_CONTINUED);
+
+    resyncTimeline();
+    int32_t late = micros() - (timelineEpoch + timelinePosition);
+    if (frameSkipping && _delayAfterDecode &&
+        late >= (int32_t)(frameDelay * 10000) &&
+        nextFastFrameCoversViewport(frameEnd)) {
+      // Not drawn, but the frames after may keep its palette
+      if (paletteCount > 0 && paletteCount <= 256) {
+        seekStream(paletteRecord + FASTGIF_RECORD_SIZE);
+        colorCount = paletteCount;
+        readColorTable(paletteCount);
+      }
+      droppedFrames++;
+      timelinePosition += frameDelay * 10000;
+      cycleTime += frameDelay * 10;
+      seekStream(frameEnd);
+      fastFrameIndex++;
+      frameNo++;
+      return ERROR_NONE;
+    }
+    seekStream(frameStart);
+  }
+
+  bool drawn = false;
+  do {
+    unsigned long recordStart = filePositionCallback();
+    readIntoBuffer(record, FASTGIF_RECORD_SIZE);
+    uint32_t recordSize =
+        fastGifWord(record) | (uint32_t)fastGifWord(record + 2) << 16;
+    flags = record[4];
+    int16_t skip =
+        (flags & FASTGIF_TRANSPARENT) ? record[5] : NO_TRANSPARENT_INDEX;
+    frameDelay = fastGifWord(record + 6);
+    int x = fastGifWord(record + 8);
+    int y = fastGifWord(record + 10);
+    int width = fastGifWord(record + 12);
+    int height = fastGifWord(record + 14);
+    int paletteCount = fastGifWord(record + 16);
+    drawn = drawn || (width > 0 && height > 0);
+    if (paletteCount > 256 ||
+        recordSize < FASTGIF_RECORD_SIZE + 3UL * paletteCount) {
+      return ERROR_BADGIFFORMAT;
+    }
+
+    if (paletteCount) {
+      colorCount = paletteCount;
+      readColorTable(paletteCount);
+    }
+
+    // Clip the rectangle to the viewport
+    int frameX = x - viewportX;
+    int frameY = y - viewportY;
+    int align = (frameX < 0) ? -frameX : 0;
+    int xofs = (frameX < 0) ? 0 : frameX;
+    int writable = min(frameX + width, viewportWidth) - xofs;
+    if (writable < 0)
+      writable = 0;
+
+    GIF_PROFILE_PHASE(GIF_PHASE_OUTPUT);
+    fastRemaining = recordSize - FASTGIF_RECORD_SIZE - 3UL * paletteCount;
+    fastBufPos = fastBufLen = 0;
+    for (int row = 0; row < height; row++) {
+      int line = frameY + row;
+      if (line >= viewportHeight)
+        break;
+      if (line < 0 || writable == 0) {
+        fastDecodeRow(NULL, width, 0, 0, flags & FASTGIF_RLE);
+        continue;
+      }
+      fastDecodeRow(rowBuf, width, align, writable, flags & FASTGIF_RLE);
+      outputLine(xofs, line, rowBuf, writable, skip);
+    }
+    GIF_PROFILE_PHASE(GIF_PHASE_PARSE);
+
+    seekStream(recordStart + recordSize);
+  } while (flags & FASTGIF_CONTINUED);
+
+  fastFrameIndex++;
+  frameNo++;
+  if (duplicateFrameSkipping && !drawn) {
+    duplicateFrames++;
+    presentFrame(false);
+  } else {
+    presentFrame();
+  }
+  return ERROR_NONE;
+}
+
+// Whether the frame starting at position is opaque and covers the whole
+// viewport, like nextFrameCoversViewport().  The last frame is never dropped,
+// as the next may not be played.  The stream is left where it was
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+bool GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
+    nextFastFrameCoversViewport(unsigned long position) {
+  if (fastFrameIndex + 1 >= fastFrameTotal)
+    return false;
+
+  uint8_t record[FASTGIF_RECORD_SIZE];
+  unsigned long positionBefore = filePositionCallback();
+  seekStream(position);
+  readIntoBuffer(record, FASTGIF_RECORD_SIZE);
+  seekStream(positionBefore);
+
+  int x = fastGifWord(record + 8) - viewportX;
+  int y = fastGifWord(record + 10) - viewportY;
+  int w = fastGifWord(record + 12);
+  int h = fastGifWord(record + 14);
+  return !(record[4] & FASTGIF_TRANSPARENT) && x <= 0 && y <= 0 &&
+         x + w >= viewportWidth && y + h >= viewportHeight;
+}
@@ -1,8 +1,51 @@
 #ifndef _GIFDECODER_H_
 #define _GIFDECODER_H_
 
+#ifndef NO_IMAGEDATA
 #define NO_IMAGEDATA 2
+#endif
+
+// With NO_IMAGEDATA < 2, bits per pixel the imageData (and imageDataBU)
+// canvas is sized for: 8, or 4 or 2 to halve or quarter its RAM.  A GIF whose
+// viewport fits the canvas at more bits per pixel is stored with more, which
+// is faster.  Otherwise only GIFs whose color tables have up to 16 colors (4
+// with 2 bits) can be played, like lzwMaxBits below 12 doesn't suit every
+// GIF: decodeFrame() returns ERROR_TOOMANYCOLORS for a table with more
+#ifndef GIF_IMAGEDATA_BITS
+#define GIF_IMAGEDATA_BITS 8
+#endif
+
+// Pixel formats of the palette given to the line callback, and of the colors
+// given to the pixel and span format callbacks, GifDecoder's pixelFormat
+// template parameter.  Color tables are converted to it when
+// they're read, so each format's output needs no conversion per pixel
+#define GIF_PIXEL_RGB565 0    // uint16_t, RRRRRGGG GGGBBBBB
+#define GIF_PIXEL_RGB565_BE 1 // uint16_t, byte swapped for SPI or DMA
+#define GIF_PIXEL_RGB888 2    // uint32_t, 0x00RRGGBB
+#define GIF_PIXEL_RGBA8888 3  // uint32_t, 0xRRGGBBAA with alpha 0xff
+#define GIF_PIXEL_RGB24 4     // rgb_24, laid out like SmartMatrix's rgb24
+#define GIF_PIXEL_RGB48 5     // rgb_48, laid out like SmartMatrix's rgb48
+
+// The pixel format for GifDecoders that don't give one.  USE_PALETTE565 is
+// deprecated: it was always defined when RGB565 was the only format, and it's
+// still defined when the default is GIF_PIXEL_RGB565 (or GIF_PIXEL_RGB565_BE,
+// picked by ARCADA_TFT_D0 and USE_SPI_DMA as before).  A sketch defining it
+// gets that default
+#ifndef GIF_PIXEL_FORMAT
+#if defined(ARCADA_TFT_D0) || defined(USE_SPI_DMA)
+#define GIF_PIXEL_FORMAT GIF_PIXEL_RGB565_BE
+#else
+#define GIF_PIXEL_FORMAT GIF_PIXEL_RGB565
+#endif
+#endif
+#if GIF_PIXEL_FORMAT == GIF_PIXEL_RGB565 ||                                    \
+    GIF_PIXEL_FORMAT == GIF_PIXEL_RGB565_BE
+#ifndef USE_PALETTE565
 #define USE_PALETTE565
+#endif
+#elif defined(USE_PALETTE565)
+#error "USE_PALETTE565 is deprecated and means GIF_PIXEL_RGB565"
+#endif
 
 #include <stdint.h>
 
@@ -13,14 +56,23 @@
 typedef void (*callback)(void);
 typedef void (*pixel_callback)(int16_t x, int16_t y, uint8_t red, uint8_t green,
                                uint8_t blue);
+// The line callback for the RGB565 formats, see GifDecoder::pixel_line_callback
 typedef void (*line_callback)(int16_t x, int16_t y, uint8_t *buf, int16_t wid,
                               uint16_t *palette565, int16_t skip);
+typedef void (*span_callback)(int16_t x, int16_t y, int16_t len, uint8_t red,
+                              uint8_t green, uint8_t blue);
 typedef void *(*get_buffer_callback)(void);
+typedef bool (*save_rect_callback)(int16_t x, int16_t y, int16_t width,
+                                   int16_t height);
+typedef void (*rect_callback)(int16_t x, int16_t y, int16_t width,
+                              int16_t height);
 
 typedef bool (*file_seek_callback)(unsigned long position);
 typedef unsigned long (*file_position_callback)(void);
 typedef int (*file_read_callback)(void);
 typedef int (*file_read_block_callback)(void *buffer, int numberOfBytes);
+typedef bool (*metadata_callback)(uint8_t label, int index,
+                                  const uint8_t *data, int len);
 
 typedef struct rgb_24 {
   uint8_t red;
@@ -28,6 +80,139 @@ typedef struct rgb_24 {
   uint8_t blue;
 } rgb_24;
 
+typedef struct rgb_48 {
+  uint16_t red;
+  uint16_t green;
+  uint16_t blue;
+} rgb_48;
+
+// How each pixel format converts a color, and whether it needs a converted
+// table or uses the rgb_24 one
+template <int pixelFormat> struct gif_pixel_format;
+
+template <> struct gif_pixel_format<GIF_PIXEL_RGB565> {
+  typedef uint16_t pixel;
+  static const bool converted = true;
+  static pixel convert(uint8_t r, uint8_t g, uint8_t b) {
+    return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+  }
+};
+
+template <> struct gif_pixel_format<GIF_PIXEL_RGB565_BE> {
+  typedef uint16_t pixel;
+  static const bool converted = true;
+  static pixel convert(uint8_t r, uint8_t g, uint8_t b) {
+    return __builtin_bswap16(((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3));
+  }
+};
+
+template <> struct gif_pixel_format<GIF_PIXEL_RGB888> {
+  typedef uint32_t pixel;
+  static const bool converted = true;
+  static pixel convert(uint8_t r, uint8_t g, uint8_t b) {
+    return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+  }
+};
+
+template <> struct gif_pixel_format<GIF_PIXEL_RGBA8888> {
+  typedef uint32_t pixel;
+  static const bool converted = true;
+  static pixel convert(uint8_t r, uint8_t g, uint8_t b) {
+    return ((uint32_t)r << 24) | ((uint32_t)g << 16) | ((uint32_t)b << 8) |
+           0xff;
+  }
+};
+
+template <> struct gif_pixel_format<GIF_PIXEL_RGB24> {
+  typedef rgb_24 pixel;
+  static const bool converted = false;
+  static pixel convert(uint8_t r, uint8_t g, uint8_t b) {
+    rgb_24 c = {r, g, b};
+    return c;
+  }
+};
+
+template <> struct gif_pixel_format<GIF_PIXEL_RGB48> {
+  typedef rgb_48 pixel;
+  static const bool converted = true;
+  static pixel convert(uint8_t r, uint8_t g, uint8_t b) {
+    rgb_48 c = {(uint16_t)(r * 257), (uint16_t)(g * 257), (uint16_t)(b * 257)};
+    return c;
+  }
+};
+
+// Number of converted color tables kept.  Each entry takes 768 bytes plus 256
+// pixels in the pixel format (none for GIF_PIXEL_RGB24), 1280 bytes for
+// RGB565, so one is kept by default, the same RAM as before tables were
+// cached.  Define it as 2 or more before including GifDecoder.h so GIFs that
+// switch between a few local color tables don't convert them again every frame
+#ifndef GIF_PALETTE_CACHE_SIZE
+#define GIF_PALETTE_CACHE_SIZE 1
+#endif
+
+// Microseconds behind the timeline after which the timeline is moved on to
+// the frame due now, instead of showing every late frame back to back to catch
+// up, e.g. after a slow card read or the sketch not calling decodeFrame() for
+// a while
+#ifndef GIF_RESYNC_LATENESS
+#define GIF_RESYNC_LATENESS 1000000
+#endif
+
+// A color table converted for output, with gamma and brightness applied
+template <int pixelFormat> struct gif_palette {
+  uint32_t hash; // of the raw color table as read from the file
+  int colorCount; // 0 if the entry is unused
+  rgb_24 rgb[256];
+  typename gif_pixel_format<pixelFormat>::pixel
+      pixels[gif_pixel_format<pixelFormat>::converted ? 256 : 1];
+};
+
+// Define GIF_PROFILING before including GifDecoder.h to have the decoder time
+// each phase of decoding.  Times are in micros() unless GIF_PROFILE_CLOCK is
+// defined, e.g. as ARM_DWT_CYCCNT to count cycles on Teensy
+#if defined(GIF_PROFILING)
+#ifndef GIF_PROFILE_CLOCK
+#define GIF_PROFILE_CLOCK() micros()
+#endif
+
+#define GIF_PHASE_NONE -1
+#define GIF_PHASE_PARSE 0   // header, extensions and descriptors
+#define GIF_PHASE_PRESCAN 1 // scanning the sub-blocks to find the frame's end
+#define GIF_PHASE_LZW 2
+#define GIF_PHASE_COMPOSE 3 // disposal and filling the image buffers
+#define GIF_PHASE_OUTPUT 4  // draw and update screen callbacks
+#define GIF_PHASE_WAIT 5    // waiting for the frame delay
+#define GIF_PHASE_COUNT 6
+
+// Trace events: the phases above are sent when they start (GIF_PHASE_NONE
+// when the decoder returns), plus these events
+#define GIF_TRACE_LATE_PRESENT 6 // value is how late the frame is, in us
+
+typedef void (*trace_callback)(int event, uint32_t time, uint32_t value);
+
+typedef struct gif_profile {
+  uint32_t phaseTime[GIF_PHASE_COUNT];
+  uint32_t bytesRead;
+  uint32_t seeks;
+  uint32_t frames;
+} gif_profile;
+#endif
+
+// Define GIF_OUTPUT_TRANSFORM before including GifDecoder.h for
+// setOutputTransform() and setPanelMap(), to draw on panels that are mounted
+// rotated or chained in another order without remapping every pixel in the
+// callbacks.  Transforms for setOutputTransform(), a rotation (clockwise) or'd
+// with flips, which are applied to the viewport before it's rotated
+#define GIF_ROTATE_0 0
+#define GIF_ROTATE_90 1
+#define GIF_ROTATE_180 2
+#define GIF_ROTATE_270 3
+#define GIF_FLIP_X 4
+#define GIF_FLIP_Y 8
+
+// Or'd with a setPanelMap() entry for a panel that's mounted upside down
+#define GIF_PANEL_UPSIDE_DOWN 0x80
+
 // LZW constants
 // NOTE: LZW_MAXBITS should be set to 10 or 11 for small displays, 12 for large
 // displays
@@ -35,10 +220,59 @@ typedef struct rgb_24 {
 //   LZW_MAXBITS = 12 will support all GIFs, but takes 16kB RAM
 #define LZW_SIZTABLE (1 << lzwMaxBits)
 
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits> class GifDecoder {
+#define GIF_IMAGEDATA_SIZE                                                     \
+  (((maxGifWidth * GIF_IMAGEDATA_BITS + 7) / 8) * maxGifHeight)
+
+// How far decodeStep() has got with the current frame
+#define GIF_STEP_IDLE 0    // between frames
+#define GIF_STEP_LZW 1     // decoding its lines
+#define GIF_STEP_OUTPUT 2  // outputting its lines from imageData
+#define GIF_STEP_PRESENT 3 // waiting for its presentation time
+
+// The longest line that can be output, with rotation a column of the viewport
+#define GIF_OUTPUT_LINE_SIZE                                                   \
+  (maxGifWidth > maxGifHeight ? maxGifWidth : maxGifHeight)
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits,
+          int pixelFormat = GIF_PIXEL_FORMAT>
+class GifDecoder {
 public:
+  // The line callback's palette is in pixelFormat, for the RGB565 formats
+  // this is a line_callback
+  typedef typename gif_pixel_format<pixelFormat>::pixel pixel_t;
+  typedef void (*pixel_line_callback)(int16_t x, int16_t y, uint8_t *buf,
+                                      int16_t wid, pixel_t *palette,
+                                      int16_t skip);
+  // The pixel and span callbacks given the color in pixelFormat, from the
+  // converted color table, rather than 8-bit RGB to convert for every pixel
+  typedef void (*pixel_format_callback)(int16_t x, int16_t y, pixel_t color);
+  typedef void (*span_format_callback)(int16_t x, int16_t y, int16_t len,
+                                       pixel_t color);
+
   int startDecoding(void);
   int decodeFrame(bool delayAfterDecode = true);
+
+  // Decode the next frame a slice at a time, for sketches with other work to
+  // do in loop().  Each call stops between lines once it has taken budget
+  // microseconds (0 for no limit) and returns ERROR_WAITING, until the frame
+  // is drawn and presented and it returns what decodeFrame() would have.
+  // With delayAfterDecode it returns ERROR_WAITING until the frame is due
+  // rather than waiting for it.  Every call decodes at least one line, but
+  // parsing up to a frame (which reads through its image data once) and
+  // outputting a frame rotated 90 or 270 degrees aren't split up.  Like
+  // between decodeFrame() calls the file has to be left where it is, and
+  // don't call decodeFrame() or change the viewport, transform or callbacks
+  // while a frame is part decoded
+  int decodeStep(uint32_t budget, bool delayAfterDecode = true);
+
+  // Decode just the first frame into buffer, width x height pixels, for a
+  // thumbnail or menu.  The GIF (or the viewport) is scaled to fit with the
+  // nearest pixel, pixels the frame doesn't draw are black.  There's no
+  // delay, no callbacks are called except to read the file, and the file is
+  // only read up to the end of the first frame: call startDecoding() before
+  // decoding frames afterwards.  Returns ERROR_NONE or the error
+  int decodePosterFrame(rgb_24 *buffer, int width, int height);
+
   int getCycleTime(void) { return cycleTime; }   //.kbv
   int getCycleNo(void) { return cycleNo; }       //.kbv
   unsigned long getFrameNo(void) { return frameNo; }  //.kbv which frame in animation
@@ -49,46 +283,195 @@ public:
     *h = lsdHeight;
   }
 
+  // Only decode a window of the GIF: x/y/width/height are in GIF (source)
+  // coordinates, and the callbacks are given coordinates relative to the
+  // window.  maxGifWidth/maxGifHeight then only need to cover the window.
+  // Changed between frames while playing, the next frame is composed again
+  // from the background, as the first frame is.
+  void setViewport(int x, int y, int width, int height);
+
+#if defined(GIF_OUTPUT_TRANSFORM)
+  // Rotate and/or flip the viewport for the display, e.g. GIF_ROTATE_90 |
+  // GIF_FLIP_X.  Rotated 90 or 270 degrees, the display is the viewport's
+  // height wide.  Lines are transformed as they're output, but lines that
+  // become columns are drawn a pixel at a time, unless NO_IMAGEDATA < 2 when
+  // the frame is output a column at a time to draw whole lines
+  void setOutputTransform(int transform);
+
+  // Draw the (transformed) display on a chain of panels.  The display is cut
+  // into panelWidth x panelHeight tiles, left to right then top to bottom,
+  // and map has each tile's position in the chain, or'd with
+  // GIF_PANEL_UPSIDE_DOWN for panels mounted upside down, like every other
+  // row of a serpentine chain.  The callbacks then get coordinates on a
+  // single row of panels.  map isn't copied, NULL draws without it again
+  void setPanelMap(int panelWidth, int panelHeight, const uint8_t *map);
+#endif
+
+  // Color correction applied to the palette when a color table is read, so
+  // callbacks get corrected colors without any per-pixel work.  These take
+  // effect from the next color table read, call them before startDecoding()
+  void setGamma(float gamma);
+  void setBrightness(uint8_t brightness);
+
   void setScreenClearCallback(callback f);
   void setUpdateScreenCallback(callback f);
   void setDrawPixelCallback(pixel_callback f);
-  void setDrawLineCallback(line_callback f);
+  void setDrawLineCallback(pixel_line_callback f);
+  void setDrawSpanCallback(span_callback f); // runs of one color, used instead of setDrawPixelCallback if set
+  // The same with the color in pixelFormat, used instead of the RGB ones if set
+  void setDrawPixelFormatCallback(pixel_format_callback f);
+  void setDrawSpanFormatCallback(span_format_callback f);
   void setStartDrawingCallback(callback f); // note this is not called when NO_IMAGEDATA == 2, and has not been tested recently
 
+  // Disposal method 3 (restore to previous) with NO_IMAGEDATA == 2: the
+  // decoder keeps no pixels, so it asks the display to save the rectangle a
+  // frame is about to draw over, and to put it back before the next frame.
+  // The save callback returns false if it can't (e.g. the rectangle is larger
+  // than its buffer), and the screen is cleared instead, as without them
+  void setSaveRectCallback(save_rect_callback f);
+  void setRestoreRectCallback(rect_callback f);
+
   void setFileSeekCallback(file_seek_callback f);
   void setFilePositionCallback(file_position_callback f);
   void setFileReadCallback(file_read_callback f);
   void setFileReadBlockCallback(file_read_block_callback f);
 
+  // Comment (label 0xfe), plain text (0x01) and application (0xff) extensions
+  // are skipped, a sub-block per read, unless this callback is set.  It's
+  // given each sub-block in turn, index 0 being the first (the plain text
+  // header, or the application identifier and authentication code), and
+  // returns true to be given the next one or false to skip the rest.  The
+  // NETSCAPE2.0 loop count is read by the decoder whatever the callback
+  // returns, before it's given the sub-block, see getLoopCount()
+  void setMetadataCallback(metadata_callback f);
+
   int getFrameNumber(void) { return frameNo; }
 
+  // The GIF's NETSCAPE2.0 loop count: -1 if it has none, 0 to loop forever,
+  // otherwise how many times it repeats after the first.  Once it has played
+  // that many times decodeFrame() returns ERROR_DONE_PARSING without drawing,
+  // leaving the last frame up.  GIFs without a loop count loop forever.  A
+  // .fgf file has the loop count of the GIF it was made from, 0 if it had none
+  int getLoopCount(void) { return loopCount; }
+  bool isFinished(void) { return finished; }
+
+  // True if the file is the pre-decoded fast playback format rather than a GIF
+  bool isFastFormat(void) { return fastFormat; }
+
+  // Frames are presented on an absolute timeline: the epoch (the micros() time
+  // startDecoding() was called, unless set after that) plus the delays of all
+  // the frames before, so time lost on one frame isn't added to the rest.
+  // Decoders given the same epoch in their own micros() time present the
+  // same frame at the same moment.  Only startDecoding() and this set the
+  // epoch: falling more than GIF_RESYNC_LATENESS behind moves the position on
+  // the timeline forward by whole frame delays instead, so playback carries
+  // on from now still in step with the epoch
+  void setTimelineEpoch(uint32_t epoch) { timelineEpoch = epoch; }
+  uint32_t getTimelineEpoch(void) { return timelineEpoch; }
+  uint32_t getNextPresentationTime(void) {
+    return timelineEpoch + timelinePosition;
+  }
+
+  // When decoding falls behind the timeline, skip frames that are completely
+  // covered by the next frame, to stay on time instead of playing in slow
+  // motion.  getDroppedFrames() counts them, and the frame times skipped by
+  // moving the timeline on after falling more than GIF_RESYNC_LATENESS behind.
+  // .fgf files are resynced and skipped the same way
+  void setFrameSkipping(bool enable) { frameSkipping = enable; }
+  unsigned long getDroppedFrames(void) { return droppedFrames; }
+
+  // Skip frames that are the same as the frame before (the same image data,
+  // colors, position and graphic control) when that frame is left on the
+  // screen: they aren't decoded or drawn and the screen isn't updated, only
+  // their delay is kept.  For GIFs that hold an image by repeating the frame.
+  // In a .fgf file these are the frames that draw nothing
+  void setDuplicateFrameSkipping(bool enable) {
+    duplicateFrameSkipping = enable;
+  }
+  unsigned long getDuplicateFrames(void) { return duplicateFrames; }
+
+#if defined(GIF_PROFILING)
+  // Stats for the last frame decoded, and totals since startDecoding()
+  const gif_profile &getFrameProfile(void) { return frameProfile; }
+  const gif_profile &getTotalProfile(void) { return totalProfile; }
+  void resetProfile(void);
+  static const char *getPhaseName(int phase);
+  // Called with the profiling clock's time at every phase change
+  void setTraceCallback(trace_callback f) { traceCallback = f; }
+#endif
+
 private:
-  void parseTableBasedImage(void);
+  int parseTableBasedImage(void);
+  int startFrame(void);
   void decompressAndDisplayFrame(unsigned long filePositionAfter);
+  void beginFrameLines(unsigned long filePositionAfter);
+  bool decodeFrameLines(uint32_t start, uint32_t budget);
+  void endFrameLines(void);
+#if NO_IMAGEDATA < 2
+  bool outputFrameLines(uint32_t start, uint32_t budget);
+#endif
+  bool nextFrameCoversViewport(unsigned long position);
+  void resyncTimeline(void);
+  void presentFrame(bool updateScreen = true);
+  void showFrame(bool updateScreen);
   int parseData(void);
   int parseGIFFileTerminator(void);
   void parseCommentExtension(void);
   void parseApplicationExtension(void);
   void parseGraphicControlExtension(void);
   void parsePlainTextExtension(void);
+  void skipSubBlocks(void);
+  void readSubBlocks(uint8_t label, int index);
   void parseGlobalColorTable(void);
+  void restoreGlobalColorTable(void);
+  void readColorTable(int count);
+  void setPalette(gif_palette<pixelFormat> *entry);
+  void updateColorCorrection(void);
   void parseLogicalScreenDescriptor(void);
   bool parseGifHeader(void);
+  void outputLine(int16_t x, int16_t y, uint8_t *buf, int16_t wid,
+                  int16_t skip);
+  void outputDisplayLine(int16_t x, int16_t y, uint8_t *buf, int16_t wid,
+                         int16_t skip);
+  bool outputRect(bool save, int x, int y, int width, int height);
+#if defined(GIF_OUTPUT_TRANSFORM)
+  void transformPoint(int x, int y, int *displayX, int *displayY);
+  void outputSegment(int16_t x, int16_t y, uint8_t *buf, int16_t len,
+                     bool vertical, int16_t skip);
+  void outputPanelLine(int16_t x, int16_t y, uint8_t *buf, int16_t wid,
+                       int16_t skip);
+  void outputImageDataColumns(int x, int y, int width, int height,
+                              int16_t skip);
+#endif
+  void outputPosterLine(int16_t x, int16_t y, uint8_t *buf, int16_t wid,
+                        int16_t skip);
   void copyImageDataRect(uint8_t *dst, uint8_t *src, int x, int y, int width,
                          int height);
   void fillImageData(uint8_t colorIndex);
   void fillImageDataRect(uint8_t colorIndex, int x, int y, int width,
                          int height);
+  void setImageDataBits(void);
+  void packImageDataLine(uint8_t *row, int x, const uint8_t *buf, int len);
+  void unpackImageDataLine(uint8_t *buf, const uint8_t *row, int x, int len);
   int readIntoBuffer(void *buffer, int numberOfBytes);
   int readWord(void);
   void backUpStream(int n);
+  void seekStream(unsigned long position);
   int readByte(void);
 
+#if defined(GIF_LZW_BENCHMARK)
+  // extras/host/LzwBench.cpp decodes image data with these on their own
+public:
+#endif
   void lzw_decode_init(int csize);
-  int lzw_decode(uint8_t *buf, int len,
-                 uint8_t *bufend); //, int align = 0);  //.kbv
+  int lzw_decode(uint8_t *buf, int len, uint8_t *bufend,
+                 int align = 0); //.kbv
+  int lzw_decode_pixels(uint8_t *buf, int len);
   void lzw_setTempBuffer(uint8_t *tempBuffer);
   int lzw_get_code(void);
+#if defined(GIF_LZW_BENCHMARK)
+private:
+#endif
 
   // Logical screen descriptor attributes
   int lsdWidth;
@@ -106,6 +489,34 @@ private:
   bool tbiInterlaced;
 
   bool _delayAfterDecode;
+  bool frameSkipping = false;
+  unsigned long droppedFrames;
+  bool duplicateFrameSkipping = false;
+  unsigned long duplicateFrames;
+  // Hash of the last frame drawn, 0 when the next frame can't be skipped as
+  // a duplicate of it
+  uint32_t lastFrameHash;
+  // The raw color table hash of the active palette
+  uint32_t paletteHash;
+  // How far through the frame decodeStep() is, GIF_STEP_xxx, and the frame's
+  // lines: the next line and its interlace pass (4 when not interlaced), the
+  // frame's y and where its lines decode to relative to the viewport, the
+  // part of each line that's output and the color it skips, and with
+  // NO_IMAGEDATA < 2 the next line of imageData to output
+  bool stepping = false;
+  int stepState = GIF_STEP_IDLE;
+  bool stepUpdateScreen;
+  int linePass;
+  int lineNo;
+  int lineFrameY;
+  int lineDecodeX;
+  int lineAlign;
+  int lineOutputX;
+  int lineOutputEnd;
+  int lineSkip;
+  int lineOutputY;
+  // Where the frame's image data ends
+  unsigned long lineFilePositionAfter;
   unsigned int frameDelay;
   int transparentColorIndex;
   int prevBackgroundIndex;
@@ -113,43 +524,124 @@ private:
   int disposalMethod;
   int lzwCodeSize;
   bool keyFrame;
+  // Set by setViewport(), imageData is started again with the next frame
+  bool viewportChanged;
   int rectX;
   int rectY;
   int rectWidth;
   int rectHeight;
+  // The display saved the rectangle, to restore for the next frame
+  bool rectSaved;
+  int viewportX = 0;
+  int viewportY = 0;
+  int viewportWidth = maxGifWidth;
+  int viewportHeight = maxGifHeight;
+#if defined(GIF_OUTPUT_TRANSFORM)
+  int outputTransform = GIF_ROTATE_0;
+  const uint8_t *panelMap = NULL;
+  int panelWidth;
+  int panelHeight;
+#endif
   int cycleNo; //.kbv
+  int loopCount;
+  bool finished;
+  // Where the first block after the global color table is, to loop back to
+  unsigned long firstBlockPosition;
+  // The global color table's hash, to find it in paletteCache when looping
+  uint32_t globalColorTableHash;
   int cycleTime;
   unsigned long frameNo;    //.kbv
   int frameCount; //.kbv
                   //    int frameSize; //.kbv
 
-  uint32_t frameStartTime;
+  uint32_t timelineEpoch;
+  // Time from the epoch to when the next frame is to be presented
+  uint32_t timelinePosition;
 
   int colorCount;
-  rgb_24 palette[256];
-#if defined(USE_PALETTE565)
-  uint16_t palette565[256];
-#endif
+  gif_palette<pixelFormat> paletteCache[GIF_PALETTE_CACHE_SIZE];
+  int paletteCacheNext;
+  // The active color table, pointing into paletteCache
+  rgb_24 *palette = paletteCache[0].rgb;
+  // and in pixelFormat, for the line callback
+  pixel_t *linePalette = gif_pixel_format<pixelFormat>::converted
+                             ? paletteCache[0].pixels
+                             : (pixel_t *)paletteCache[0].rgb;
+  float gamma = 1.0;
+  uint8_t brightness = 255;
+  bool colorCorrection = false;
+  uint8_t colorCorrectionTable[256];
 
   char tempBuffer[260];
 
+  // Set while decodePosterFrame() draws the frame into buffer, scaled from
+  // the source size to the poster's
+  rgb_24 *posterBuffer = NULL;
+  int posterWidth;
+  int posterHeight;
+  int posterSourceWidth;
+  int posterSourceHeight;
+
+  // Pre-decoded fast playback format, see FastGifDecoder_Impl.h
+  bool parseFastHeader(void);
+  int decodeFastFrame(void);
+  bool nextFastFrameCoversViewport(unsigned long position);
+  int fastReadByte(void);
+  void fastRead(uint8_t *buf, int len);
+  void fastDecodeRow(uint8_t *buf, int width, int align, int writable,
+                     bool rle);
+  bool fastFormat;
+  int fastAlignShift;
+  int fastFrameTotal;
+  int fastFrameIndex;
+  unsigned long fastFirstRecord;
+  // Record bytes not yet read into tempBuffer, and the unread part of it
+  uint32_t fastRemaining;
+  int fastBufPos;
+  int fastBufLen;
+
+#if NO_IMAGEDATA == 2
+  // The line being decoded and output, which keeps the background either side
+  // of the frame from line to line
+  uint8_t imageBuf[maxGifWidth];
+#endif
 #if NO_IMAGEDATA < 2
-  // Buffer image data is decoded into
-  uint8_t imageData[maxGifWidth * maxGifHeight];
+  // Buffer image data is decoded into, imageDataBits per pixel with the
+  // leftmost pixel in the low bits of each byte, rows imageDataStride apart
+  uint8_t imageData[GIF_IMAGEDATA_SIZE];
+  int imageDataBits = 8;
+  int imageDataStride = maxGifWidth;
 #endif
 #if NO_IMAGEDATA < 1
   // Backup image data buffer for saving portions of image disposal method == 3
-  uint8_t imageDataBU[maxGifWidth * maxGifHeight];
+  uint8_t imageDataBU[GIF_IMAGEDATA_SIZE];
 #endif
   callback screenClearCallback;
   callback updateScreenCallback;
   pixel_callback drawPixelCallback;
-  line_callback drawLineCallback;
+  pixel_line_callback drawLineCallback;
+  span_callback drawSpanCallback;
+  pixel_format_callback drawPixelFormatCallback = NULL;
+  span_format_callback drawSpanFormatCallback = NULL;
   callback startDrawingCallback;
+  save_rect_callback saveRectCallback;
+  rect_callback restoreRectCallback;
   file_seek_callback fileSeekCallback;
   file_position_callback filePositionCallback;
   file_read_callback fileReadCallback;
   file_read_block_callback fileReadBlockCallback;
+  metadata_callback metadataCallback = NULL;
+
+#if defined(GIF_PROFILING)
+  void profilePhase(int phase);
+  void endFrameProfile(void);
+  gif_profile frameProfile;
+  gif_profile totalProfile;
+  int profileCurrentPhase = GIF_PHASE_NONE;
+  uint32_t profilePhaseStart;
+  bool profileFrameDone;
+  trace_callback traceCallback;
+#endif
 
   // LZW variables
   int bbits;
@@ -182,5 +674,6 @@ private:
 
 #include "GifDecoder_Impl.h"
 #include "LzwDecoder_Impl.h"
+#include "FastGifDecoder_Impl.h"
 
 #endif
@@ -68,10 +68,21 @@
 #define ERROR_FILENOTGIF -2
 #define ERROR_BADGIFFORMAT -3
 #define ERROR_UNKNOWNCONTROLEXT -4
+#define ERROR_TOOMANYCOLORS -5
+
+#if defined(GIF_PROFILING)
+#define GIF_PROFILE_PHASE(phase) profilePhase(phase)
+#define GIF_PROFILE_COUNT(counter, n) frameProfile.counter += (n)
+#else
+#define GIF_PROFILE_PHASE(phase)
+#define GIF_PROFILE_COUNT(counter, n)
+#endif
 
 #define GIFHDRTAGNORM "GIF87a"  // tag in valid GIF file
 #define GIFHDRTAGNORM1 "GIF89a" // tag in valid GIF file
 #define GIFHDRSIZE 6
+// The global color table follows the header and logical screen descriptor
+#define GIFGCTPOSITION 13
 
 // Global GIF specific definitions
 #define COLORTBLFLAG 0x80
@@ -86,71 +97,214 @@
 #define DISPOSAL_BACKGROUND 2
 #define DISPOSAL_RESTORE 3
 
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::setStartDrawingCallback(
-    callback f) {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::setStartDrawingCallback(callback f) {
   startDrawingCallback = f;
 }
 
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::setUpdateScreenCallback(
-    callback f) {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::setSaveRectCallback(save_rect_callback f) {
+  saveRectCallback = f;
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::setRestoreRectCallback(rect_callback f) {
+  restoreRectCallback = f;
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::setMetadataCallback(metadata_callback f) {
+  metadataCallback = f;
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::setUpdateScreenCallback(callback f) {
   updateScreenCallback = f;
 }
 
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::setDrawPixelCallback(
-    pixel_callback f) {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::setDrawPixelCallback(pixel_callback f) {
   drawPixelCallback = f;
 }
 
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::setDrawLineCallback(
-    line_callback f) {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::setDrawLineCallback(pixel_line_callback f) {
   drawLineCallback = f;
 }
 
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::setScreenClearCallback(
-    callback f) {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::setDrawSpanCallback(span_callback f) {
+  drawSpanCallback = f;
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
+    setDrawPixelFormatCallback(pixel_format_callback f) {
+  drawPixelFormatCallback = f;
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
+    setDrawSpanFormatCallback(span_format_callback f) {
+  drawSpanFormatCallback = f;
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::setScreenClearCallback(callback f) {
   screenClearCallback = f;
 }
 
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::setFileSeekCallback(
-    file_seek_callback f) {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::setFileSeekCallback(file_seek_callback f) {
   fileSeekCallback = f;
 }
 
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::setFilePositionCallback(
-    file_position_callback f) {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
+    setFilePositionCallback(file_position_callback f) {
   filePositionCallback = f;
 }
 
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::setFileReadCallback(
-    file_read_callback f) {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::setFileReadCallback(file_read_callback f) {
   fileReadCallback = f;
 }
 
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
     setFileReadBlockCallback(file_read_block_callback f) {
   fileReadBlockCallback = f;
 }
 
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::setViewport(int x, int y, int width, int height) {
+  viewportX = x;
+  viewportY = y;
+  // the window can't be bigger than the buffers allocated for it
+  viewportWidth = min(width, maxGifWidth);
+  viewportHeight = min(height, maxGifHeight);
+  // imageData is laid out for the viewport, and the disposal rectangle is in
+  // its coordinates, so the next frame starts again from the background like
+  // the first one
+  setImageDataBits();
+  viewportChanged = true;
+  prevDisposalMethod = DISPOSAL_NONE;
+  rectSaved = false;
+  // The next frame is drawn somewhere else even if it's the same
+  lastFrameHash = 0;
+}
+
+#if defined(GIF_OUTPUT_TRANSFORM)
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::setOutputTransform(int transform) {
+  outputTransform = transform;
+  lastFrameHash = 0;
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
+    setPanelMap(int width, int height, const uint8_t *map) {
+  panelWidth = width;
+  panelHeight = height;
+  panelMap = map;
+  lastFrameHash = 0;
+}
+#endif
+
+#if defined(GIF_PROFILING)
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::resetProfile() {
+  memset(&frameProfile, 0, sizeof(frameProfile));
+  memset(&totalProfile, 0, sizeof(totalProfile));
+  profileFrameDone = false;
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+const char *
+GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::getPhaseName(
+    int phase) {
+  switch (phase) {
+  case GIF_PHASE_PARSE:
+    return "parse";
+  case GIF_PHASE_PRESCAN:
+    return "prescan";
+  case GIF_PHASE_LZW:
+    return "lzw";
+  case GIF_PHASE_COMPOSE:
+    return "compose";
+  case GIF_PHASE_OUTPUT:
+    return "output";
+  case GIF_PHASE_WAIT:
+    return "wait";
+  default:
+    return "none";
+  }
+}
+
+// Charge the time since the last call to the phase that was running, and
+// start timing the next one.  Phases never overlap, so they add up to the
+// total time spent in the decoder
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::profilePhase(int phase) {
+  uint32_t now = GIF_PROFILE_CLOCK();
+  if (profileCurrentPhase != GIF_PHASE_NONE)
+    frameProfile.phaseTime[profileCurrentPhase] += now - profilePhaseStart;
+  profileCurrentPhase = phase;
+  profilePhaseStart = now;
+  if (traceCallback)
+    (*traceCallback)(phase, now, 0);
+}
+
+// Add the frame's stats to the totals
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::endFrameProfile() {
+  frameProfile.frames = 1;
+  for (int i = 0; i < GIF_PHASE_COUNT; i++)
+    totalProfile.phaseTime[i] += frameProfile.phaseTime[i];
+  totalProfile.bytesRead += frameProfile.bytesRead;
+  totalProfile.seeks += frameProfile.seeks;
+  totalProfile.frames++;
+  profileFrameDone = true;
+}
+#endif
+
 // Backup the read stream by n bytes
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::backUpStream(int n) {
-  fileSeekCallback(filePositionCallback() - n);
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::backUpStream(int n) {
+  seekStream(filePositionCallback() - n);
+}
+
+// Move the read stream to an absolute position
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::seekStream(unsigned long position) {
+  GIF_PROFILE_COUNT(seeks, 1);
+  fileSeekCallback(position);
 }
 
 // Read a file byte
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::readByte() {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::readByte() {
 
   int b = fileReadCallback();
+  GIF_PROFILE_COUNT(bytesRead, 1);
   if (b == -1) {
 #if GIFDEBUG == 1
     Serial.println("Read error or EOF occurred");
@@ -160,8 +314,8 @@ int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::readByte() {
 }
 
 // Read a file word
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::readWord() {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::readWord() {
 
   int b0 = readByte();
   int b1 = readByte();
@@ -169,80 +323,586 @@ int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::readWord() {
 }
 
 // Read the specified number of bytes into the specified buffer
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::readIntoBuffer(
-    void *buffer, int numberOfBytes) {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+               pixelFormat>::readIntoBuffer(void *buffer, int numberOfBytes) {
 
   int result = fileReadBlockCallback(buffer, numberOfBytes);
+  GIF_PROFILE_COUNT(bytesRead, numberOfBytes);
   if (result == -1) {
     Serial.println("Read error or EOF occurred");
   }
-#if defined(USE_PALETTE565)
-  if (buffer == palette) {
-    for (int i = 0; i < 256; i++) {
-#if !defined(ARCADA_TFT_D0) && !defined(USE_SPI_DMA)
-      uint8_t r = palette[i].red;
-      uint8_t g = palette[i].green;
-      uint8_t b = palette[i].blue;
-      palette565[i] = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | ((b & 0xF8) >> 3);
-#else
-      // Pre-endian-swap in the palette
-      palette565[i] = __builtin_bswap16(((palette[i].red & 0xF8) << 8) |
-                                        ((palette[i].green & 0xFC) << 3) |
-                                        ((palette[i].blue) >> 3));
+  return result;
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::setGamma(float g) {
+  gamma = g;
+  updateColorCorrection();
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::setBrightness(uint8_t b) {
+  brightness = b;
+  updateColorCorrection();
+}
+
+// Build the table used to correct each color channel
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::updateColorCorrection() {
+
+  colorCorrection = (gamma != 1.0) || (brightness != 255);
+  for (int i = 0; i < 256; i++) {
+    colorCorrectionTable[i] =
+        (uint8_t)(pow(i / 255.0, gamma) * brightness + 0.5);
+  }
+
+  // Converted color tables are stale now, and a repeated frame needs drawing
+  // in the new colors
+  for (int i = 0; i < GIF_PALETTE_CACHE_SIZE; i++) {
+    paletteCache[i].colorCount = 0;
+  }
+  lastFrameHash = 0;
+}
+
+// Read a color table of count entries and make it the active palette.  The
+// raw table is hashed so a table that is still in paletteCache is reused
+// instead of converted again
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::readColorTable(int count) {
+
+  // Read into an entry that isn't the active palette, unless there's only one
+  gif_palette<pixelFormat> *entry = &paletteCache[paletteCacheNext];
+  if (GIF_PALETTE_CACHE_SIZE > 1 && entry->rgb == palette) {
+    paletteCacheNext = (paletteCacheNext + 1) % GIF_PALETTE_CACHE_SIZE;
+    entry = &paletteCache[paletteCacheNext];
+  }
+  readIntoBuffer(entry->rgb, sizeof(rgb_24) * count);
+
+  // FNV-1a hash of the raw table
+  uint32_t hash = 2166136261UL;
+  uint8_t *p = (uint8_t *)entry->rgb;
+  for (int i = 0; i < (int)sizeof(rgb_24) * count; i++) {
+    hash = (hash ^ p[i]) * 16777619UL;
+  }
+
+  for (int i = 0; i < GIF_PALETTE_CACHE_SIZE; i++) {
+    gif_palette<pixelFormat> *cached = &paletteCache[i];
+    if (cached != entry && cached->colorCount == count &&
+        cached->hash == hash) {
+      // Already converted, the entry just read into is free again
+      entry->colorCount = 0;
+      setPalette(cached);
+      return;
+    }
+  }
+
+  // Convert only the colors in the table
+  for (int i = 0; i < count; i++) {
+    if (colorCorrection) {
+      entry->rgb[i].red = colorCorrectionTable[entry->rgb[i].red];
+      entry->rgb[i].green = colorCorrectionTable[entry->rgb[i].green];
+      entry->rgb[i].blue = colorCorrectionTable[entry->rgb[i].blue];
+    }
+    if (gif_pixel_format<pixelFormat>::converted) {
+      entry->pixels[i] = gif_pixel_format<pixelFormat>::convert(
+          entry->rgb[i].red, entry->rgb[i].green, entry->rgb[i].blue);
+    }
+  }
+  entry->hash = hash;
+  entry->colorCount = count;
+  paletteCacheNext = (paletteCacheNext + 1) % GIF_PALETTE_CACHE_SIZE;
+
+  setPalette(entry);
+}
+
+// Make a paletteCache entry the active palette.  Formats without a converted
+// table give the line callback the rgb_24 table
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::setPalette(gif_palette<pixelFormat> *entry) {
+  palette = entry->rgb;
+  paletteHash = entry->hash;
+  linePalette = gif_pixel_format<pixelFormat>::converted
+                    ? entry->pixels
+                    : (pixel_t *)entry->rgb;
+}
+
+// Fill a rectangle of a byte per pixel buffer with rows stride bytes apart, a
+// row at a time, or all at once when the rows are whole
+static inline void gifFillRect(uint8_t *buf, int stride, uint8_t value, int x,
+                               int y, int width, int height) {
+  if (width <= 0 || height <= 0)
+    return;
+  uint8_t *row = buf + y * stride + x;
+  if (width == stride) {
+    memset(row, value, width * height);
+    return;
+  }
+  for (int yy = 0; yy < height; yy++, row += stride)
+    memset(row, value, width);
+}
+
+// Copy a rectangle between byte per pixel buffers with rows stride bytes
+// apart, a row at a time, or all at once when the rows are whole
+static inline void gifCopyRect(uint8_t *__restrict dst,
+                               const uint8_t *__restrict src, int stride,
+                               int x, int y, int width, int height) {
+  if (width <= 0 || height <= 0)
+    return;
+  int offset = y * stride + x;
+  if (width == stride) {
+    memcpy(dst + offset, src + offset, width * height);
+    return;
+  }
+  for (int yy = 0; yy < height; yy++, offset += stride)
+    memcpy(dst + offset, src + offset, width);
+}
+
+// Set one cell of a row of packed imageData
+static inline void setImageDataCell(uint8_t *row, int x, int bits,
+                                    uint8_t value) {
+  int perByteShift = (bits == 4) ? 1 : 2;
+  int shift = (x & ((1 << perByteShift) - 1)) * bits;
+  uint8_t mask = ((1 << bits) - 1) << shift;
+  uint8_t *p = row + (x >> perByteShift);
+  *p = (*p & ~mask) | ((value << shift) & mask);
+}
+
+// Copy one cell of a row of packed imageData
+static inline void copyImageDataCell(uint8_t *dst, const uint8_t *src, int x,
+                                     int bits) {
+  int perByteShift = (bits == 4) ? 1 : 2;
+  int shift = (x & ((1 << perByteShift) - 1)) * bits;
+  uint8_t mask = ((1 << bits) - 1) << shift;
+  int i = x >> perByteShift;
+  dst[i] = (dst[i] & ~mask) | (src[i] & mask);
+}
+
+// Store imageData with as many bits per pixel as fit the viewport
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::setImageDataBits(void) {
+#if NO_IMAGEDATA < 2
+  imageDataBits = 8;
+#if GIF_IMAGEDATA_BITS < 8
+  while (imageDataBits > GIF_IMAGEDATA_BITS &&
+         (viewportWidth * imageDataBits + 7) / 8 * viewportHeight >
+             (int)sizeof(imageData)) {
+    imageDataBits /= 2;
+  }
+#endif
+  imageDataStride = (viewportWidth * imageDataBits + 7) / 8;
 #endif
+}
+
+// Store len palette indices from buf in a row of packed imageData, starting
+// at pixel x.  Whole bytes are built at once, the cells sharing a byte with
+// pixels outside the line one at a time
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
+    packImageDataLine(uint8_t *row, int x, const uint8_t *buf, int len) {
+#if NO_IMAGEDATA < 2
+  int bits = imageDataBits;
+  int perByte = 8 / bits;
+  int end = x + len;
+  while (x < end && (x & (perByte - 1))) {
+    setImageDataCell(row, x++, bits, *buf++);
+  }
+  uint8_t *p = row + x / perByte;
+  if (bits == 4) {
+    for (; x + 2 <= end; x += 2, buf += 2) {
+      *p++ = (buf[0] & 0x0f) | (buf[1] << 4);
+    }
+  } else {
+    for (; x + 4 <= end; x += 4, buf += 4) {
+      *p++ = (buf[0] & 0x03) | ((buf[1] & 0x03) << 2) |
+             ((buf[2] & 0x03) << 4) | (buf[3] << 6);
     }
   }
+  while (x < end) {
+    setImageDataCell(row, x++, bits, *buf++);
+  }
+#endif
+}
+
+// Read len palette indices into buf from a row of packed imageData, starting
+// at pixel x
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
+    unpackImageDataLine(uint8_t *buf, const uint8_t *row, int x, int len) {
+#if NO_IMAGEDATA < 2
+  int bits = imageDataBits;
+  int perByteShift = (bits == 4) ? 1 : 2;
+  int cellMask = (1 << perByteShift) - 1;
+  uint8_t mask = (1 << bits) - 1;
+  for (int i = 0; i < len; i++, x++) {
+    buf[i] = (row[x >> perByteShift] >> ((x & cellMask) * bits)) & mask;
+  }
 #endif
-  return result;
 }
 
 // Fill a portion of imageData buffer with a color index
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::fillImageDataRect(
-    uint8_t colorIndex, int x, int y, int width, int height) {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
+    fillImageDataRect(uint8_t colorIndex, int x, int y, int width, int height) {
 
 #if NO_IMAGEDATA < 2
-  int yOffset = 0;
-
-  for (int yy = y; yy < height + y; yy++) {
-    yOffset = yy * maxGifWidth;
-    for (int xx = x; xx < width + x; xx++) {
-      imageData[yOffset + xx] = colorIndex;
+#if GIF_IMAGEDATA_BITS < 8
+  if (imageDataBits < 8) {
+    // Whole bytes of the rectangle are set with memset, the cells sharing a
+    // byte with pixels outside it one at a time
+    int bits = imageDataBits;
+    int perByte = 8 / bits;
+    uint8_t pattern =
+        (colorIndex & ((1 << bits) - 1)) * ((bits == 4) ? 0x11 : 0x55);
+    for (int yy = y; yy < height + y; yy++) {
+      uint8_t *row = imageData + yy * imageDataStride;
+      int xx = x;
+      int end = x + width;
+      while (xx < end && (xx & (perByte - 1))) {
+        setImageDataCell(row, xx++, bits, colorIndex);
+      }
+      int bytes = (end - xx) / perByte;
+      memset(row + xx / perByte, pattern, bytes);
+      xx += bytes * perByte;
+      while (xx < end) {
+        setImageDataCell(row, xx++, bits, colorIndex);
+      }
     }
+    return;
   }
+#endif
+  gifFillRect(imageData, imageDataStride, colorIndex, x, y, width, height);
 #endif
 }
 
 // Fill entire imageData buffer with a color index
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::fillImageData(
-    uint8_t colorIndex) {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::fillImageData(uint8_t colorIndex) {
 
 #if NO_IMAGEDATA < 2
+#if GIF_IMAGEDATA_BITS < 8
+  if (imageDataBits < 8) {
+    colorIndex &= (1 << imageDataBits) - 1;
+    colorIndex *= (imageDataBits == 4) ? 0x11 : 0x55;
+  }
+#endif
   memset(imageData, colorIndex, sizeof(imageData));
 #endif
 }
 
 // Copy image data in rect from a src to a dst
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::copyImageDataRect(
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::copyImageDataRect(
     uint8_t *dst, uint8_t *src, int x, int y, int width, int height) {
 
-  int yOffset, offset;
+#if NO_IMAGEDATA < 2
+#if GIF_IMAGEDATA_BITS < 8
+  if (imageDataBits < 8) {
+    // Whole bytes of the rectangle are copied with memcpy, the cells sharing
+    // a byte with pixels outside it one at a time
+    int bits = imageDataBits;
+    int perByte = 8 / bits;
+    for (int yy = y; yy < height + y; yy++) {
+      int yOffset = yy * imageDataStride;
+      int xx = x;
+      int end = x + width;
+      while (xx < end && (xx & (perByte - 1))) {
+        copyImageDataCell(dst + yOffset, src + yOffset, xx++, bits);
+      }
+      int bytes = (end - xx) / perByte;
+      memcpy(dst + yOffset + xx / perByte, src + yOffset + xx / perByte,
+             bytes);
+      xx += bytes * perByte;
+      while (xx < end) {
+        copyImageDataCell(dst + yOffset, src + yOffset, xx++, bits);
+      }
+    }
+    return;
+  }
+#endif
+  gifCopyRect(dst, src, imageDataStride, x, y, width, height);
+#endif
+}
+
+// Send one line of palette indices to the display callbacks, pixels equal to
+// skip are left untouched
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::outputLine(
+    int16_t x, int16_t y, uint8_t *buf, int16_t wid, int16_t skip) {
+
+  if (posterBuffer) {
+    outputPosterLine(x, y, buf, wid, skip);
+#if defined(GIF_OUTPUT_TRANSFORM)
+  } else if (outputTransform != GIF_ROTATE_0 || panelMap) {
+    outputSegment(x, y, buf, wid, false, skip);
+#endif
+  } else {
+    outputDisplayLine(x, y, buf, wid, skip);
+  }
+}
+
+// Send a line in display coordinates to the display callbacks
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
+    outputDisplayLine(int16_t x, int16_t y, uint8_t *buf, int16_t wid,
+                      int16_t skip) {
+
+  if (drawLineCallback) {
+    (*drawLineCallback)(x, y, buf, wid, linePalette, skip);
+  } else if (drawSpanFormatCallback || drawSpanCallback) {
+    // Find runs of the same palette index, transparent runs aren't drawn
+    int i = 0;
+    while (i < wid) {
+      uint8_t pixel = buf[i];
+      int start = i;
+      while (++i < wid && buf[i] == pixel)
+        ;
+      if (pixel == skip)
+        continue;
+      if (drawSpanFormatCallback)
+        (*drawSpanFormatCallback)(x + start, y, i - start, linePalette[pixel]);
+      else
+        (*drawSpanCallback)(x + start, y, i - start, palette[pixel].red,
+                            palette[pixel].green, palette[pixel].blue);
+    }
+  } else if (drawPixelFormatCallback) {
+    for (int i = 0; i < wid; i++) {
+      uint8_t pixel = buf[i];
+      if (pixel != skip)
+        (*drawPixelFormatCallback)(x + i, y, linePalette[pixel]);
+    }
+  } else if (drawPixelCallback) {
+    for (int i = 0; i < wid; i++) {
+      uint8_t pixel = buf[i];
+      if (pixel != skip)
+        (*drawPixelCallback)(x + i, y, palette[pixel].red,
+                             palette[pixel].green, palette[pixel].blue);
+    }
+  }
+}
+
+// Have the display save (or restore) a rectangle of the viewport, returns
+// false if it couldn't save all of it
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+bool GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
+    outputRect(bool save, int x, int y, int width, int height) {
+
+#if defined(GIF_OUTPUT_TRANSFORM)
+  // The rectangle on the display
+  int x0, y0, x1, y1;
+  transformPoint(x, y, &x0, &y0);
+  transformPoint(x + width - 1, y + height - 1, &x1, &y1);
+  int left = min(x0, x1);
+  int top = min(y0, y1);
+  int right = (x0 > x1 ? x0 : x1) + 1;
+  int bottom = (y0 > y1 ? y0 : y1) + 1;
+
+  // and the part of it on each panel, without a panel map there's one panel
+  int tileWidth = panelMap ? panelWidth : right;
+  int tileHeight = panelMap ? panelHeight : bottom;
+  int displayWidth = (outputTransform & 1) ? viewportHeight : viewportWidth;
+  bool saved = true;
+  for (int tileY = top / tileHeight; tileY * tileHeight < bottom; tileY++) {
+    for (int tileX = left / tileWidth; tileX * tileWidth < right; tileX++) {
+      // The part on this panel, in the panel's coordinates
+      int tileLeft = tileX * tileWidth;
+      int tileTop = tileY * tileHeight;
+      int pieceLeft = (left > tileLeft ? left : tileLeft) - tileLeft;
+      int pieceTop = (top > tileTop ? top : tileTop) - tileTop;
+      int pieceRight = min(right, tileLeft + tileWidth) - tileLeft;
+      int pieceBottom = min(bottom, tileTop + tileHeight) - tileTop;
+      int chainX = tileLeft;
+      int chainY = tileTop;
+      if (panelMap) {
+        uint8_t entry = panelMap[tileY * (displayWidth / tileWidth) + tileX];
+        if (entry & GIF_PANEL_UPSIDE_DOWN) {
+          int flippedLeft = tileWidth - pieceRight;
+          int flippedTop = tileHeight - pieceBottom;
+          pieceRight = tileWidth - pieceLeft;
+          pieceBottom = tileHeight - pieceTop;
+          pieceLeft = flippedLeft;
+          pieceTop = flippedTop;
+        }
+        chainX = (entry & ~GIF_PANEL_UPSIDE_DOWN) * tileWidth;
+        chainY = 0;
+      }
+      int pieceX = chainX + pieceLeft;
+      int pieceY = chainY + pieceTop;
+      int pieceWidth = pieceRight - pieceLeft;
+      int pieceHeight = pieceBottom - pieceTop;
+      if (save) {
+        if (!(*saveRectCallback)(pieceX, pieceY, pieceWidth, pieceHeight))
+          saved = false;
+      } else {
+        (*restoreRectCallback)(pieceX, pieceY, pieceWidth, pieceHeight);
+      }
+    }
+  }
+  return saved;
+#else
+  if (save)
+    return (*saveRectCallback)(x, y, width, height);
+  (*restoreRectCallback)(x, y, width, height);
+  return true;
+#endif
+}
 
-  for (int yy = y; yy < height + y; yy++) {
-    yOffset = yy * maxGifWidth;
-    for (int xx = x; xx < width + x; xx++) {
-      offset = yOffset + xx;
-      dst[offset] = src[offset];
+#if defined(GIF_OUTPUT_TRANSFORM)
+// Where a point of the viewport is on the display
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
+    transformPoint(int x, int y, int *displayX, int *displayY) {
+  if (outputTransform & GIF_FLIP_X)
+    x = viewportWidth - 1 - x;
+  if (outputTransform & GIF_FLIP_Y)
+    y = viewportHeight - 1 - y;
+  switch (outputTransform & 3) {
+  case GIF_ROTATE_0:
+    *displayX = x;
+    *displayY = y;
+    break;
+  case GIF_ROTATE_90:
+    *displayX = viewportHeight - 1 - y;
+    *displayY = x;
+    break;
+  case GIF_ROTATE_180:
+    *displayX = viewportWidth - 1 - x;
+    *displayY = viewportHeight - 1 - y;
+    break;
+  case GIF_ROTATE_270:
+    *displayX = y;
+    *displayY = viewportWidth - 1 - x;
+    break;
+  }
+}
+
+// Output len pixels of the viewport, a line or (vertical) a column starting at
+// x, y, where they are on the display
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
+    outputSegment(int16_t x, int16_t y, uint8_t *buf, int16_t len,
+                  bool vertical, int16_t skip) {
+  int x0, y0, x1, y1;
+  transformPoint(x, y, &x0, &y0);
+  transformPoint(vertical ? x : x + len - 1, vertical ? y + len - 1 : y, &x1,
+                 &y1);
+  if (y0 == y1) {
+    // A line on the display, reversed if it runs right to left
+    if (x1 < x0) {
+      uint8_t line[GIF_OUTPUT_LINE_SIZE];
+      for (int i = 0; i < len; i++)
+        line[i] = buf[len - 1 - i];
+      outputPanelLine(x1, y0, line, len, skip);
+    } else {
+      outputPanelLine(x0, y0, buf, len, skip);
+    }
+  } else {
+    // A column on the display, drawn a pixel at a time
+    int step = (y1 > y0) ? 1 : -1;
+    for (int i = 0; i < len; i++) {
+      if (buf[i] != skip)
+        outputPanelLine(x0, y0 + i * step, buf + i, 1, skip);
+    }
+  }
+}
+
+// Output a line of the display, split where it crosses from one panel to the
+// next when there's a panel map
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
+    outputPanelLine(int16_t x, int16_t y, uint8_t *buf, int16_t wid,
+                    int16_t skip) {
+  if (!panelMap) {
+    outputDisplayLine(x, y, buf, wid, skip);
+    return;
+  }
+  int displayWidth = (outputTransform & 1) ? viewportHeight : viewportWidth;
+  const uint8_t *tiles =
+      panelMap + (y / panelHeight) * (displayWidth / panelWidth);
+  int panelY = y % panelHeight;
+  while (wid > 0) {
+    int panelX = x % panelWidth;
+    int len = min(wid, panelWidth - panelX);
+    uint8_t entry = tiles[x / panelWidth];
+    int chainX = (entry & ~GIF_PANEL_UPSIDE_DOWN) * panelWidth;
+    if (entry & GIF_PANEL_UPSIDE_DOWN) {
+      uint8_t line[GIF_OUTPUT_LINE_SIZE];
+      for (int i = 0; i < len; i++)
+        line[i] = buf[len - 1 - i];
+      outputDisplayLine(chainX + panelWidth - panelX - len,
+                        panelHeight - 1 - panelY, line, len, skip);
+    } else {
+      outputDisplayLine(chainX + panelX, panelY, buf, len, skip);
+    }
+    x += len;
+    buf += len;
+    wid -= len;
+  }
+}
+
+// Output a rectangle of imageData a column at a time, for a rotated display
+// whose lines are the viewport's columns
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
+    outputImageDataColumns(int x, int y, int width, int height, int16_t skip) {
+#if NO_IMAGEDATA < 2
+  uint8_t column[maxGifHeight];
+  for (int xx = x; xx < x + width; xx++) {
+    const uint8_t *row = imageData + y * imageDataStride;
+    for (int i = 0; i < height; i++, row += imageDataStride) {
+#if GIF_IMAGEDATA_BITS < 8
+      if (imageDataBits < 8) {
+        unpackImageDataLine(column + i, row, xx, 1);
+        continue;
+      }
+#endif
+      column[i] = row[xx];
+    }
+    outputSegment(xx, y, column, height, true, skip);
+  }
+#endif
+}
+#endif
+
+// Draw a line of the frame into the poster buffer: each poster pixel takes
+// the source pixel its top left corner falls in
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::outputPosterLine(
+    int16_t x, int16_t y, uint8_t *buf, int16_t wid, int16_t skip) {
+
+  // Poster rows and columns whose source pixel is in this line
+  int rowStart =
+      (y * posterHeight + posterSourceHeight - 1) / posterSourceHeight;
+  int rowEnd = min(((y + 1) * posterHeight + posterSourceHeight - 1) /
+                       posterSourceHeight,
+                   posterHeight);
+  int colStart = (x * posterWidth + posterSourceWidth - 1) / posterSourceWidth;
+  int colEnd = min(((x + wid) * posterWidth + posterSourceWidth - 1) /
+                       posterSourceWidth,
+                   posterWidth);
+  for (int row = rowStart; row < rowEnd; row++) {
+    rgb_24 *out = posterBuffer + row * posterWidth;
+    for (int col = colStart; col < colEnd; col++) {
+      uint8_t pixel = buf[col * posterSourceWidth / posterWidth - x];
+      if (pixel != skip)
+        out[col] = palette[pixel];
     }
   }
 }
 
 // Make sure the file is a Gif file
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-bool GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::parseGifHeader() {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+bool GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::parseGifHeader() {
 
   char buffer[10];
 
@@ -256,9 +916,9 @@ bool GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::parseGifHeader() {
 }
 
 // Parse the logical screen descriptor
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight,
-                lzwMaxBits>::parseLogicalScreenDescriptor() {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::parseLogicalScreenDescriptor() {
 
   lsdWidth = readWord();
   lsdHeight = readWord();
@@ -283,9 +943,9 @@ void GifDecoder<maxGifWidth, maxGifHeight,
 }
 
 // Parse the global color table
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight,
-                lzwMaxBits>::parseGlobalColorTable() {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::parseGlobalColorTable() {
 
   // Does a global color table exist?
   if (lsdPackedField & COLORTBLFLAG) {
@@ -299,37 +959,89 @@ void GifDecoder<maxGifWidth, maxGifHeight,
     Serial.println(" colors present");
 #endif
     // Read color values into the palette array
-    int colorTableBytes = sizeof(rgb_24) * colorCount;
-    readIntoBuffer(palette, colorTableBytes);
+    readColorTable(colorCount);
+    for (int i = 0; i < GIF_PALETTE_CACHE_SIZE; i++) {
+      if (paletteCache[i].rgb == palette)
+        globalColorTableHash = paletteCache[i].hash;
+    }
+  }
+  firstBlockPosition = filePositionCallback();
+}
+
+// Make the global color table active again when looping, from paletteCache if
+// it's still there, otherwise by reading it again
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::restoreGlobalColorTable() {
+
+  if (!(lsdPackedField & COLORTBLFLAG))
+    return;
+
+  colorCount = 1 << ((lsdPackedField & 7) + 1);
+  for (int i = 0; i < GIF_PALETTE_CACHE_SIZE; i++) {
+    gif_palette<pixelFormat> *cached = &paletteCache[i];
+    if (cached->colorCount == colorCount &&
+        cached->hash == globalColorTableHash) {
+      setPalette(cached);
+      return;
+    }
+  }
+  seekStream(GIFGCTPOSITION);
+  readColorTable(colorCount);
+}
+
+// Skip sub-blocks up to and including the empty block that ends them.  Each
+// is read along with the length of the next in one go, as reading is much
+// faster than seeking
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::skipSubBlocks() {
+  int len = readByte();
+  while (len > 0) {
+    if (fileReadBlockCallback(tempBuffer, len + 1) != len + 1)
+      return;
+    GIF_PROFILE_COUNT(bytesRead, len + 1);
+    len = (uint8_t)tempBuffer[len];
+  }
+}
+
+// Read sub-blocks and pass them to the metadata callback, numbering them from
+// index, until it returns false and the rest are skipped
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::readSubBlocks(uint8_t label, int index) {
+  int len = readByte();
+  while (len > 0) {
+    readIntoBuffer(tempBuffer, len);
+    if (!(*metadataCallback)(label, index++, (const uint8_t *)tempBuffer,
+                             len)) {
+      skipSubBlocks();
+      return;
+    }
+    len = readByte();
   }
 }
 
 // Parse plain text extension and dispose of it
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight,
-                lzwMaxBits>::parsePlainTextExtension() {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::parsePlainTextExtension() {
 
 #if GIFDEBUG == 1 && DEBUG_PROCESSING_PLAIN_TEXT_EXT == 1
   Serial.println("\nProcessing Plain Text Extension");
 #endif
-  // Read plain text header length
-  uint8_t len = readByte();
-
-  // Consume plain text header data
-  readIntoBuffer(tempBuffer, len);
-
-  // Consume the plain text data in blocks
-  len = readByte();
-  while (len != 0) {
-    readIntoBuffer(tempBuffer, len);
-    len = readByte();
+  if (metadataCallback) {
+    // The plain text header is block 0, the text follows
+    readSubBlocks(0x01, 0);
+  } else {
+    skipSubBlocks();
   }
 }
 
 // Parse a graphic control extension
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight,
-                lzwMaxBits>::parseGraphicControlExtension() {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::parseGraphicControlExtension() {
 
 #if GIFDEBUG == 1 && DEBUG_PROCESSING_GRAPHIC_CONTROL_EXT == 1
   Serial.println("\nProcessing Graphic Control Extension");
@@ -368,11 +1080,9 @@ void GifDecoder<maxGifWidth, maxGifHeight,
 }
 
 // Parse application extension
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight,
-                lzwMaxBits>::parseApplicationExtension() {
-
-  memset(tempBuffer, 0, sizeof(tempBuffer));
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::parseApplicationExtension() {
 
 #if GIFDEBUG == 1 && DEBUG_PROCESSING_APP_EXT == 1
   Serial.println("\nProcessing Application Extension");
@@ -383,6 +1093,7 @@ void GifDecoder<maxGifWidth, maxGifHeight,
 
   // Read app data
   readIntoBuffer(tempBuffer, len);
+  tempBuffer[len] = 0;
 
 #if GIFDEBUG == 1 && DEBUG_PROCESSING_APP_EXT == 1
   // Conditionally display the application extension string
@@ -392,48 +1103,74 @@ void GifDecoder<maxGifWidth, maxGifHeight,
   }
 #endif
 
-  // Consume any additional app data
-  len = readByte();
-  while (len != 0) {
-    readIntoBuffer(tempBuffer, len);
+  // The loop count is in the NETSCAPE2.0 (or ANIMEXTS1.0) extension's
+  // sub-block with ID 1
+  bool looping = len == 11 && (memcmp(tempBuffer, "NETSCAPE2.0", 11) == 0 ||
+                               memcmp(tempBuffer, "ANIMEXTS1.0", 11) == 0);
+
+  if (looping) {
+    // The callback is given the blocks like any other application extension,
+    // each after the loop count in it has been read
+    bool wanted = metadataCallback &&
+                  (*metadataCallback)(0xff, 0, (const uint8_t *)tempBuffer, len);
+    int index = 1;
     len = readByte();
+    while (len != 0) {
+      readIntoBuffer(tempBuffer, len);
+      if (len == 3 && tempBuffer[0] == 1)
+        loopCount = (uint8_t)tempBuffer[1] | ((uint8_t)tempBuffer[2] << 8);
+      if (wanted)
+        wanted = (*metadataCallback)(0xff, index++,
+                                     (const uint8_t *)tempBuffer, len);
+      len = readByte();
+    }
+  } else if (metadataCallback &&
+             (*metadataCallback)(0xff, 0, (const uint8_t *)tempBuffer, len)) {
+    readSubBlocks(0xff, 1);
+  } else {
+    skipSubBlocks();
   }
 }
 
 // Parse comment extension
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight,
-                lzwMaxBits>::parseCommentExtension() {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::parseCommentExtension() {
 
 #if GIFDEBUG == 1 && DEBUG_PROCESSING_COMMENT_EXT == 1
   Serial.println("\nProcessing Comment Extension");
 #endif
 
+  if (metadataCallback) {
+    readSubBlocks(0xfe, 0);
+    return;
+  }
+
+#if GIFDEBUG == 1 && DEBUG_PROCESSING_COMMENT_EXT == 1
   // Read block length
   uint8_t len = readByte();
   while (len != 0) {
-    // Clear buffer
-    memset(tempBuffer, 0, sizeof(tempBuffer));
-
     // Read len bytes into buffer
     readIntoBuffer(tempBuffer, len);
+    tempBuffer[len] = 0;
 
-#if GIFDEBUG == 1 && DEBUG_PROCESSING_COMMENT_EXT == 1
     // Display the comment extension string
     if (strlen(tempBuffer) != 0) {
       Serial.print("Comment Extension: ");
       Serial.println(tempBuffer);
     }
-#endif
     // Read the new block length
     len = readByte();
   }
+#else
+  skipSubBlocks();
+#endif
 }
 
 // Parse file terminator
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-int GifDecoder<maxGifWidth, maxGifHeight,
-               lzwMaxBits>::parseGIFFileTerminator() {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+               pixelFormat>::parseGIFFileTerminator() {
 
 #if GIFDEBUG == 1 && DEBUG_PROCESSING_FILE_TERM == 1
   Serial.println("\nProcessing file terminator");
@@ -454,8 +1191,9 @@ int GifDecoder<maxGifWidth, maxGifHeight,
 }
 
 // Parse table based image data
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::parseTableBasedImage() {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+               pixelFormat>::parseTableBasedImage() {
 
 #if GIFDEBUG == 1 && DEBUG_PROCESSING_TBI_DESC_START == 1
   Serial.println("\nProcessing Table Based Image Descriptor");
@@ -509,28 +1247,44 @@ void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::parseTableBasedImage() {
     Serial.println(" colors present");
 #endif
     // Read colors into palette
-    int colorTableBytes = sizeof(rgb_24) * colorCount;
-    readIntoBuffer(palette, colorTableBytes);
+    readColorTable(colorCount);
   }
 
-  // One time initialization of imageData before first frame
-  if (keyFrame) {
-    frameNo = 0; //.kbv
+  GIF_PROFILE_PHASE(GIF_PHASE_COMPOSE);
+
+  // One time initialization of imageData before first frame, and again when
+  // the viewport has changed, as imageData is laid out for it
+  if (keyFrame || viewportChanged) {
+    if (keyFrame)
+      frameNo = 0; //.kbv
+    setImageDataBits();
     if (transparentColorIndex == NO_TRANSPARENT_INDEX) {
       fillImageData(lsdBackgroundIndex);
     } else {
       fillImageData(transparentColorIndex);
     }
     keyFrame = false;
+    viewportChanged = false;
 
     rectX = 0;
     rectY = 0;
-    rectWidth = maxGifWidth;
-    rectHeight = maxGifHeight;
+    rectWidth = viewportWidth;
+    rectHeight = viewportHeight;
+  }
+
+#if NO_IMAGEDATA < 2 && GIF_IMAGEDATA_BITS < 8
+  // imageData already has as many bits per pixel as fit the viewport, so a
+  // color table with more colors than that can't be played
+  if (colorCount > (1 << imageDataBits)) {
+    Serial.print("Color table too big for imageData: ");
+    Serial.println(colorCount);
+    return ERROR_TOOMANYCOLORS;
   }
-  // Don't clear matrix screen for these disposal methods
+#endif
+  // Don't clear matrix screen for these disposal methods, or when the display
+  // puts back what the previous frame drew over
   if ((prevDisposalMethod != DISPOSAL_NONE) &&
-      (prevDisposalMethod != DISPOSAL_LEAVE)) {
+      (prevDisposalMethod != DISPOSAL_LEAVE) && !rectSaved) {
     if (screenClearCallback)
       (*screenClearCallback)();
   }
@@ -543,25 +1297,37 @@ void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::parseTableBasedImage() {
 #if NO_IMAGEDATA < 1
     copyImageDataRect(imageData, imageDataBU, rectX, rectY, rectWidth,
                       rectHeight);
+#elif NO_IMAGEDATA == 2
+    if (rectSaved)
+      outputRect(false, rectX, rectY, rectWidth, rectHeight);
 #endif
   }
+  rectSaved = false;
 
   // Save disposal method for this frame for next time
   prevDisposalMethod = disposalMethod;
 
   if (disposalMethod != DISPOSAL_NONE) {
-    // Save dimensions of this frame
-    rectX = tbiImageX;
-    rectY = tbiImageY;
+    // Save dimensions of this frame, relative to the viewport
+    rectX = tbiImageX - viewportX;
+    rectY = tbiImageY - viewportY;
     rectWidth = tbiWidth;
     rectHeight = tbiHeight;
 
-    // limit rectangle to the bounds of maxGifWidth*maxGifHeight
-    if (rectX + rectWidth > maxGifWidth)
-      rectWidth = maxGifWidth - rectX;
-    if (rectY + rectHeight > maxGifHeight)
-      rectHeight = maxGifHeight - rectY;
-    if (rectX >= maxGifWidth || rectY >= maxGifHeight) {
+    // limit rectangle to the bounds of the viewport
+    if (rectX < 0) {
+      rectWidth += rectX;
+      rectX = 0;
+    }
+    if (rectY < 0) {
+      rectHeight += rectY;
+      rectY = 0;
+    }
+    if (rectX + rectWidth > viewportWidth)
+      rectWidth = viewportWidth - rectX;
+    if (rectY + rectHeight > viewportHeight)
+      rectHeight = viewportHeight - rectY;
+    if (rectWidth <= 0 || rectHeight <= 0) {
       rectX = rectY = rectWidth = rectHeight = 0;
     }
 
@@ -575,10 +1341,18 @@ void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::parseTableBasedImage() {
 #if NO_IMAGEDATA < 1
       copyImageDataRect(imageDataBU, imageData, rectX, rectY, rectWidth,
                         rectHeight);
+#elif NO_IMAGEDATA == 2
+      // Only the frame's rectangle is saved, by the display, rather than
+      // keeping a second copy of the screen
+      rectSaved = saveRectCallback && restoreRectCallback && rectWidth > 0 &&
+                  !posterBuffer &&
+                  outputRect(true, rectX, rectY, rectWidth, rectHeight);
 #endif
     }
   }
 
+  GIF_PROFILE_PHASE(GIF_PHASE_PARSE);
+
   // Read the min LZW code size
   lzwCodeSize = readByte();
 
@@ -590,12 +1364,32 @@ void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::parseTableBasedImage() {
 #endif
 
   unsigned long filePositionBefore = filePositionCallback();
+  // this is the position where GIF decoding needs to pick up after
+  // decompressing frame.  A poster frame is the last one decoded, so the
+  // image data isn't scanned to find it
+  unsigned long filePositionAfter = filePositionBefore;
+
+  GIF_PROFILE_PHASE(GIF_PHASE_PRESCAN);
 
   // Gather the lzw image data
   // NOTE: the dataBlockSize byte is left in the data as the lzw decoder needs
   // it
   int offset = 0;
-  int dataBlockSize = readByte();
+  int dataBlockSize = posterBuffer ? 0 : readByte();
+
+  // To spot a duplicate of the last frame, the image data is hashed as it's
+  // scanned, after everything else that affects what the frame draws
+  uint32_t frameHash = 0;
+  if (duplicateFrameSkipping && !posterBuffer) {
+    int32_t frameParams[] = {tbiImageX, tbiImageY, tbiWidth, tbiHeight,
+                             tbiPackedBits, (int32_t)paletteHash,
+                             transparentColorIndex, disposalMethod,
+                             lzwCodeSize, dataBlockSize};
+    frameHash = 2166136261UL;
+    for (unsigned int i = 0; i < sizeof(frameParams); i++)
+      frameHash = (frameHash ^ ((uint8_t *)frameParams)[i]) * 16777619UL;
+  }
+
   while (dataBlockSize != 0) {
 #if GIFDEBUG == 1 && DEBUG_PROCESSING_TBI_DESC_DATABLOCKSIZE == 1
     Serial.print("dataBlockSize: ");
@@ -604,6 +1398,11 @@ void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::parseTableBasedImage() {
     offset += dataBlockSize + 1;
     // Reading is much faster than seeking
     fileReadBlockCallback(tempBuffer, dataBlockSize + 1);
+    GIF_PROFILE_COUNT(bytesRead, dataBlockSize + 1);
+    if (duplicateFrameSkipping) {
+      for (int i = 0; i <= dataBlockSize; i++)
+        frameHash = (frameHash ^ (uint8_t)tempBuffer[i]) * 16777619UL;
+    }
     dataBlockSize = (uint8_t)tempBuffer[dataBlockSize];
   }
 
@@ -614,11 +1413,12 @@ void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::parseTableBasedImage() {
   Serial.println(filePositionCallback());
 #endif
 
-  // this is the position where GIF decoding needs to pick up after
-  // decompressing frame
-  unsigned long filePositionAfter = filePositionCallback();
+  if (!posterBuffer) {
+    filePositionAfter = filePositionCallback();
+    seekStream(filePositionBefore);
+  }
 
-  fileSeekCallback(filePositionBefore);
+  GIF_PROFILE_PHASE(GIF_PHASE_LZW);
 
   // Process the animation frame for display
 
@@ -631,17 +1431,94 @@ void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::parseTableBasedImage() {
   //        frameDelay = 1;
   //    }
 
-  // Decompress LZW data and display the frame
-  decompressAndDisplayFrame(filePositionAfter);
+  frameNo++;
+
+  // A frame that's the same as the last one, which was left as it was drawn,
+  // would draw the same pixels again
+  bool duplicate = frameHash != 0 && frameHash == lastFrameHash &&
+                   (disposalMethod == DISPOSAL_NONE ||
+                    disposalMethod == DISPOSAL_LEAVE);
+  lastFrameHash = frameHash;
+
+  // If we're so far behind that the next frame is already due, and the next
+  // frame will draw over all of this one, don't decode this one at all.  More
+  // than GIF_RESYNC_LATENESS behind, the timeline is moved on instead, and the
+  // frame times skipped are counted the same
+  resyncTimeline();
+  int32_t late = micros() - (timelineEpoch + timelinePosition);
+  if (duplicate) {
+    duplicateFrames++;
+    seekStream(filePositionAfter);
+    presentFrame(false);
+  } else if (frameSkipping && _delayAfterDecode &&
+             late >= (int32_t)(frameDelay * 10000) &&
+             nextFrameCoversViewport(filePositionAfter)) {
+    droppedFrames++;
+    timelinePosition += frameDelay * 10000;
+    cycleTime += frameDelay * 10;
+    seekStream(filePositionAfter);
+    // Not drawn, so the next frame can't be skipped as the same
+    lastFrameHash = 0;
+  } else {
+    // Decompress LZW data and display the frame
+    decompressAndDisplayFrame(filePositionAfter);
+  }
+
+  GIF_PROFILE_PHASE(GIF_PHASE_PARSE);
 
   // Graphic control extension is for a single frame
   transparentColorIndex = NO_TRANSPARENT_INDEX;
   disposalMethod = DISPOSAL_NONE;
+  return ERROR_NONE;
+}
+
+// Look ahead from position to the next image descriptor, to see if the next
+// frame is opaque and covers the whole viewport.  The stream is left where it
+// was
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+bool GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::nextFrameCoversViewport(unsigned long position) {
+
+  bool transparent = false;
+  bool covers = false;
+  unsigned long positionBefore = filePositionCallback();
+
+  seekStream(position);
+  for (;;) {
+    int b = readByte();
+    if (b == 0x21) {
+      int label = readByte();
+      if (label == 0xf9) {
+        readByte(); // length
+        transparent = (readByte() & TRANSPARENTFLAG) != 0;
+        readWord(); // delay
+        readByte(); // transparent index
+        readByte(); // block end
+      } else {
+        skipSubBlocks();
+      }
+    } else if (b == 0x2c) {
+      int x = readWord() - viewportX;
+      int y = readWord() - viewportY;
+      int w = readWord();
+      int h = readWord();
+      covers = !transparent && x <= 0 && y <= 0 && x + w >= viewportWidth &&
+               y + h >= viewportHeight;
+      break;
+    } else {
+      // end of file, or bad data
+      break;
+    }
+  }
+
+  seekStream(positionBefore);
+  return covers;
 }
 
 // Parse gif data
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::parseData() {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+               pixelFormat>::parseData() {
   //    if (nextFrameTime_ms > millis())
   //        return ERROR_WAITING;
 
@@ -666,7 +1543,9 @@ int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::parseData() {
 #if GIFDEBUG == 1 && DEBUG_PARSING_DATA == 1
       Serial.println("\nParsing Table Based");
 #endif
-      parseTableBasedImage();
+      int result = parseTableBasedImage();
+      if (result < ERROR_NONE)
+        return result;
       parsedFrame = true;
 
     } else if (b == 0x21) {
@@ -714,18 +1593,40 @@ int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::parseData() {
   return ERROR_NONE;
 }
 
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::startDecoding(void) {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+               pixelFormat>::startDecoding(void) {
   // Initialize variables
   keyFrame = true;
   cycleNo = 0;
+  loopCount = -1;
+  finished = false;
   prevDisposalMethod = DISPOSAL_NONE;
+  rectSaved = false;
   transparentColorIndex = NO_TRANSPARENT_INDEX;
-  frameStartTime = micros();
-  fileSeekCallback(0);
+  timelineEpoch = micros();
+  timelinePosition = 0;
+  droppedFrames = 0;
+  duplicateFrames = 0;
+  lastFrameHash = 0;
+  stepState = GIF_STEP_IDLE;
+  fastFormat = false;
+#if defined(GIF_PROFILING)
+  // Stats are per file, header parsing is counted with the first frame
+  resetProfile();
+#endif
+  GIF_PROFILE_PHASE(GIF_PHASE_PARSE);
+  seekStream(0);
 
   // Validate the header
   if (!parseGifHeader()) {
+    // It may be the pre-decoded fast playback format instead
+    seekStream(0);
+    if (parseFastHeader()) {
+      GIF_PROFILE_PHASE(GIF_PHASE_NONE);
+      return ERROR_NONE;
+    }
+    GIF_PROFILE_PHASE(GIF_PHASE_NONE);
     Serial.println("Not a GIF file");
     return ERROR_FILENOTGIF;
   }
@@ -737,97 +1638,321 @@ int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::startDecoding(void) {
   // Parse the global color table
   parseGlobalColorTable();
 
+  GIF_PROFILE_PHASE(GIF_PHASE_NONE);
   return ERROR_NONE;
 }
 
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::decodeFrame(
-    bool delayAfterDecode) {
-  // Parse gif data
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
+    decodePosterFrame(rgb_24 *buffer, int width, int height) {
+  int result = startDecoding();
+  if (result < 0)
+    return result;
+
+  // The part of the viewport the GIF covers is scaled to the poster
+  posterSourceWidth = min(lsdWidth - viewportX, viewportWidth);
+  posterSourceHeight = min(lsdHeight - viewportY, viewportHeight);
+  if (posterSourceWidth <= 0 || posterSourceHeight <= 0) {
+    posterSourceWidth = viewportWidth;
+    posterSourceHeight = viewportHeight;
+  }
+  posterWidth = width;
+  posterHeight = height;
+  memset(buffer, 0, sizeof(rgb_24) * width * height);
+
+  posterBuffer = buffer;
+  result = decodeFrame(false);
+  posterBuffer = NULL;
+  return result;
+}
+
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+               pixelFormat>::decodeFrame(bool delayAfterDecode) {
+  stepping = false;
   _delayAfterDecode = delayAfterDecode;
-  int result = parseData();
+  return startFrame();
+}
+
+// Decode a frame in calls that each take about budget microseconds, see
+// GifDecoder.h.  The frame is parsed and its lines set up by startFrame(),
+// then stepState says what's left to do
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+               pixelFormat>::decodeStep(uint32_t budget,
+                                        bool delayAfterDecode) {
+  uint32_t start = micros();
+  stepping = true;
+
+  if (stepState == GIF_STEP_IDLE) {
+    _delayAfterDecode = delayAfterDecode;
+    int result = startFrame();
+    // Errors, the end of the GIF, and frames that were dropped rather than
+    // drawn are finished with already
+    if (result != ERROR_NONE || stepState == GIF_STEP_IDLE)
+      return result;
+  }
+
+  if (stepState == GIF_STEP_LZW) {
+    GIF_PROFILE_PHASE(GIF_PHASE_LZW);
+    if (!decodeFrameLines(start, budget)) {
+      GIF_PROFILE_PHASE(GIF_PHASE_NONE);
+      return ERROR_WAITING;
+    }
+    endFrameLines();
+#if NO_IMAGEDATA < 2
+    stepState = GIF_STEP_OUTPUT;
+    if (budget && (uint32_t)(micros() - start) >= budget) {
+      GIF_PROFILE_PHASE(GIF_PHASE_NONE);
+      return ERROR_WAITING;
+    }
+#else
+    stepState = GIF_STEP_IDLE;
+    presentFrame();
+#endif
+  }
+
+#if NO_IMAGEDATA < 2
+  if (stepState == GIF_STEP_OUTPUT) {
+    GIF_PROFILE_PHASE(GIF_PHASE_OUTPUT);
+    if (!outputFrameLines(start, budget)) {
+      GIF_PROFILE_PHASE(GIF_PHASE_NONE);
+      return ERROR_WAITING;
+    }
+    stepState = GIF_STEP_IDLE;
+    presentFrame();
+  }
+#endif
+
+  if (stepState == GIF_STEP_PRESENT) {
+    if ((int32_t)(micros() - (timelineEpoch + timelinePosition)) < 0) {
+      GIF_PROFILE_PHASE(GIF_PHASE_NONE);
+      return ERROR_WAITING;
+    }
+    stepState = GIF_STEP_IDLE;
+    showFrame(stepUpdateScreen);
+  }
+
+  GIF_PROFILE_PHASE(GIF_PHASE_NONE);
+#if defined(GIF_PROFILING)
+  endFrameProfile();
+#endif
+  return ERROR_NONE;
+}
+
+// Parse up to the next frame and decode it, or with stepping, get it ready
+// for decodeStep() to decode
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+               pixelFormat>::startFrame(void) {
+#if defined(GIF_PROFILING)
+  // Start a new frame's stats, anything parsed since the last frame
+  // (e.g. restarting at the end of the file) is counted with this one
+  if (profileFrameDone) {
+    memset(&frameProfile, 0, sizeof(frameProfile));
+    profileFrameDone = false;
+  }
+#endif
+  GIF_PROFILE_PHASE(GIF_PHASE_PARSE);
+
+  // The GIF has played as many times as its loop count asks for
+  if (finished) {
+    GIF_PROFILE_PHASE(GIF_PHASE_NONE);
+    return ERROR_DONE_PARSING;
+  }
+
+  // Parse gif data
+  int result = fastFormat ? decodeFastFrame() : parseData();
   if (result < ERROR_NONE) {
+    GIF_PROFILE_PHASE(GIF_PHASE_NONE);
     Serial.println("Error: ");
     Serial.println(result);
     Serial.println(" occurred during parsing of data");
     return result;
   }
 
-  if (result == ERROR_DONE_PARSING) {
-    // startDecoding();
-    // Initialize variables like with a new file
-    keyFrame = true;
-    prevDisposalMethod = DISPOSAL_NONE;
-    transparentColorIndex = NO_TRANSPARENT_INDEX;
-    frameStartTime = micros();
-    fileSeekCallback(0);
-
-    // parse Gif Header like with a new file
-    parseGifHeader();
-
-    // Parse the logical screen descriptor
-    parseLogicalScreenDescriptor();
-
-    // Parse the global color table
-    parseGlobalColorTable();
+  if (result == ERROR_DONE_PARSING && !fastFormat) {
+    if (loopCount > 0 && cycleNo > loopCount) {
+      finished = true;
+    } else {
+      // Initialize variables like with a new file
+      keyFrame = true;
+      prevDisposalMethod = DISPOSAL_NONE;
+      rectSaved = false;
+      transparentColorIndex = NO_TRANSPARENT_INDEX;
+      lastFrameHash = 0;
+
+      // The header and logical screen descriptor are the same every loop, so
+      // go straight back to the first block, counting the loop like
+      // parseLogicalScreenDescriptor() does
+      frameCount = frameNo;
+      cycleNo++;
+      restoreGlobalColorTable();
+      seekStream(firstBlockPosition);
+    }
   }
 
+  GIF_PROFILE_PHASE(GIF_PHASE_NONE);
+#if defined(GIF_PROFILING)
+  // A frame decodeStep() hasn't finished is counted when it is
+  if (result == ERROR_NONE && stepState == GIF_STEP_IDLE)
+    endFrameProfile();
+#endif
+
   return result;
 }
 
 // Decompress LZW data and display animation frame
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
     decompressAndDisplayFrame(unsigned long filePositionAfter) {
+  beginFrameLines(filePositionAfter);
+  if (stepping) {
+    // decodeStep() decodes the lines, as many as it has time for each call
+    stepState = GIF_STEP_LZW;
+    return;
+  }
+  decodeFrameLines(0, 0);
+  endFrameLines();
+#if NO_IMAGEDATA < 2
+  outputFrameLines(0, 0);
+#endif
+  presentFrame();
+}
 
-  // frameDelay is time to wait AFTER the frame is drawn...so, use value
-  // from prior pass. It's converted to microseconds here for better timing.
-  uint32_t priorFrameDelay = frameDelay * 10000;
+// Work out where the frame's lines go, ready to decode its first line
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::
+    beginFrameLines(unsigned long filePositionAfter) {
 
   // Each pixel of image is 8 bits and is an index into the palette
 
-  // How the image is decoded depends upon whether it is interlaced or not
-  // Decode the interlaced LZW data into the image buffer
+  // Position of the frame relative to the viewport
+  int frameX = tbiImageX - viewportX;
+  lineFrameY = tbiImageY - viewportY;
+  // Pixels at the start of each line that fall left of the viewport
+  lineAlign = (frameX < 0) ? -frameX : 0;
+  lineDecodeX = (frameX < 0) ? 0 : frameX;
+  // Portion of each line that lands in the viewport
+  lineOutputX = lineDecodeX;
+  lineOutputEnd = min(frameX + tbiWidth, viewportWidth);
+  lineSkip = transparentColorIndex;
+  lineFilePositionAfter = filePositionAfter;
+
+  // Interlaced frames are decoded in passes 0 to 3, others in pass 4
+  linePass = tbiInterlaced ? 0 : 4;
+  lineNo = 0;
+
+#if NO_IMAGEDATA == 2
+#if GIFDEBUG > 1
+  char buf[80];
+  if (frameNo == 1) {
+    sprintf(buf,
+            "Logical Screen [LZW=%d %dx%d P:0x%02X B:%d A:%d F:%dms] frames:%d "
+            "pass=%d",
+            lzwCodeSize, lsdWidth, lsdHeight, lsdPackedField,
+            lsdBackgroundIndex, lsdAspectRatio, frameDelay * 10, frameCount,
+            cycleNo);
+    Serial.println(buf);
+  }
+#if GIFDEBUG > 2
+  unsigned long filePositionBefore = filePositionCallback();
+  sprintf(buf, "Frame %2d: [=%6ld P:0x%02X B:%d F:%dms] @ %d,%d %dx%d",
+          frameNo, filePositionBefore, tbiPackedBits, transparentColorIndex,
+          frameDelay * 10, tbiImageX, tbiImageY, tbiWidth, tbiHeight);
+  Serial.println(buf);
+#endif
+#endif
+  if (disposalMethod == DISPOSAL_BACKGROUND) {
+    // the whole width of the screen is redrawn, with the background around
+    // the frame
+    lineOutputX = 0;
+    lineOutputEnd = min(lsdWidth - viewportX, viewportWidth);
+    lineSkip = -1;
+    // Every line of the frame decodes over the same part of imageBuf, so the
+    // background either side of it only needs filling once
+    GIF_PROFILE_PHASE(GIF_PHASE_COMPOSE);
+    memset(imageBuf, prevBackgroundIndex, viewportWidth);
+  }
+#endif
+}
+
+// Decode the frame's lines from where the last call stopped, in interlaced
+// order if it is.  Lines outside of the viewport are decoded to nowhere, and
+// with NO_IMAGEDATA == 2 each line is output as it's decoded.  Given a budget
+// in micros() since start, it returns false if the time ran out before the
+// last line, after decoding at least one
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+bool GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::decodeFrameLines(uint32_t start,
+                                               uint32_t budget) {
+  static const uint8_t starts[] = {0, 4, 2, 1, 0};
+  static const uint8_t incs[] = {8, 8, 4, 2, 1};
+
+#if NO_IMAGEDATA < 2 && GIF_IMAGEDATA_BITS < 8
+  // Part of each line in the viewport
+  int wid = lineOutputEnd - lineOutputX;
+  // Packed imageData lines are decoded here first
+  uint8_t lineBuf[maxGifWidth];
+#endif
+  for (bool first = true;; first = false) {
+    while (lineNo >= tbiHeight) {
+      // Pass 3 is the last of an interlaced frame
+      if (linePass >= 3)
+        return true;
+      linePass++;
+      lineNo = starts[linePass];
+    }
+    if (!first && budget && (uint32_t)(micros() - start) >= budget)
+      return false;
+
+    int y = lineNo + lineFrameY;
+    lineNo += incs[linePass];
 #if NO_IMAGEDATA < 2
-  uint8_t *p = imageData + tbiImageX;
-  if (tbiInterlaced) {
-    // Decode every 8th line starting at line 0
-    for (int line = tbiImageY + 0; line < tbiHeight + tbiImageY; line += 8) {
-      lzw_decode(p + (line * maxGifWidth), tbiWidth,
-                 min(imageData + (line * maxGifWidth) + maxGifWidth,
-                     imageData + sizeof(imageData)));
-    }
-    // Decode every 8th line starting at line 4
-    for (int line = tbiImageY + 4; line < tbiHeight + tbiImageY; line += 8) {
-      lzw_decode(p + (line * maxGifWidth), tbiWidth,
-                 min(imageData + (line * maxGifWidth) + maxGifWidth,
-                     imageData + sizeof(imageData)));
-    }
-    // Decode every 4th line starting at line 2
-    for (int line = tbiImageY + 2; line < tbiHeight + tbiImageY; line += 4) {
-      lzw_decode(p + (line * maxGifWidth), tbiWidth,
-                 min(imageData + (line * maxGifWidth) + maxGifWidth,
-                     imageData + sizeof(imageData)));
-    }
-    // Decode every 2nd line starting at line 1
-    for (int line = tbiImageY + 1; line < tbiHeight + tbiImageY; line += 2) {
-      lzw_decode(p + (line * maxGifWidth), tbiWidth,
-                 min(imageData + (line * maxGifWidth) + maxGifWidth,
-                     imageData + sizeof(imageData)));
+    if (y < 0 || y >= viewportHeight) {
+      lzw_decode(imageData, tbiWidth, imageData);
+      continue;
     }
-  } else {
-    // Decode the non interlaced LZW data into the image data buffer
-    for (int line = tbiImageY; line < tbiHeight + tbiImageY; line++) {
-      lzw_decode(p + (line * maxGifWidth), tbiWidth,
-                 imageData + sizeof(imageData));
+    uint8_t *p = imageData + (y * imageDataStride);
+#if GIF_IMAGEDATA_BITS < 8
+    if (imageDataBits < 8) {
+      lzw_decode(lineBuf, tbiWidth, lineBuf + viewportWidth - lineDecodeX,
+                 lineAlign);
+      if (wid > 0)
+        packImageDataLine(p, lineDecodeX, lineBuf, wid);
+      continue;
+    }
+#endif
+    lzw_decode(p + lineDecodeX, tbiWidth, p + viewportWidth, lineAlign);
+#else
+    GIF_PROFILE_PHASE(GIF_PHASE_LZW);
+    if (y < 0 || y >= viewportHeight) {
+      // outside of the viewport, consume the line without storing it
+      lzw_decode(imageBuf, tbiWidth, imageBuf);
+      continue;
+    }
+    lzw_decode(imageBuf + lineDecodeX, tbiWidth, imageBuf + viewportWidth,
+               lineAlign);
+    if (lineOutputEnd > lineOutputX) {
+      GIF_PROFILE_PHASE(GIF_PHASE_OUTPUT);
+      outputLine(lineOutputX, y, imageBuf + lineOutputX,
+                 lineOutputEnd - lineOutputX, lineSkip);
     }
+#endif
   }
+}
+
+// The frame's lines are decoded: move on past its image data
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::endFrameLines(void) {
 
 #if GIFDEBUG == 1 && DEBUG_DECOMPRESS_AND_DISPLAY == 1
   Serial.println("File Position After: ");
   Serial.println(filePositionCallback());
 #endif
 
+#if NO_IMAGEDATA < 2
 #if GIFDEBUG == 1 && DEBUG_WAIT_FOR_KEY_PRESS == 1
   Serial.println("\nPress Key For Next");
   while (Serial.read() <= 0)
@@ -835,116 +1960,122 @@ void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::
 #endif
 
   // LZW doesn't parse through all the data, manually set position
-  fileSeekCallback(filePositionAfter);
+  seekStream(lineFilePositionAfter);
+
+  GIF_PROFILE_PHASE(GIF_PHASE_OUTPUT);
 
   // Optional callback can be used to get drawing routines ready
-  if (startDrawingCallback)
+  if (startDrawingCallback && !posterBuffer)
     (*startDrawingCallback)();
 
-  // Image data is decompressed, now display portion of image affected by frame
-  int yOffset, pixel;
-  for (int y = tbiImageY; y < tbiHeight + tbiImageY; y++) {
-    yOffset = y * maxGifWidth;
-    for (int x = tbiImageX; x < tbiWidth + tbiImageX; x++) {
-      // Get the next pixel
-      pixel = imageData[yOffset + x];
-
-      // Check pixel transparency
-      if (pixel == transparentColorIndex) {
-        continue;
-      }
-
-      // Pixel not transparent so get color from palette and draw the pixel
-      if (drawPixelCallback)
-        (*drawPixelCallback)(x, y, palette[pixel].red, palette[pixel].green,
-                             palette[pixel].blue);
-    }
-  }
+  // Image data is decompressed, now display portion of image affected by
+  // frame, starting with its first line in the viewport
+  lineOutputY = (lineFrameY < 0) ? 0 : lineFrameY;
 #else
-#define GSZ maxGifWidth
-  //#define GSZ 221   //llama fails on 220
-  uint8_t imageBuf[GSZ];
-  //    memset(imageBuf, 0, GSZ);
-  int starts[] = {0, 4, 2, 1, 0};
-  int incs[] = {8, 8, 4, 2, 1};
-  frameNo++;
-#if GIFDEBUG > 1
-  char buf[80];
-  if (frameNo == 1) {
-    sprintf(buf,
-            "Logical Screen [LZW=%d %dx%d P:0x%02X B:%d A:%d F:%dms] frames:%d "
-            "pass=%d",
-            lzwCodeSize, lsdWidth, lsdHeight, lsdPackedField,
-            lsdBackgroundIndex, lsdAspectRatio, frameDelay * 10, frameCount,
-            cycleNo);
-    Serial.println(buf);
+  GIF_PROFILE_PHASE(GIF_PHASE_PARSE);
+  // LZW doesn't parse through all the data, manually set position
+  seekStream(lineFilePositionAfter);
+#endif
+}
+
+#if NO_IMAGEDATA < 2
+// Output the part of imageData the frame drew on, from where the last call
+// stopped.  A budget works like it does for decodeFrameLines()
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+bool GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::outputFrameLines(uint32_t start,
+                                               uint32_t budget) {
+  int wid = lineOutputEnd - lineOutputX;
+  int yEnd = min(lineFrameY + tbiHeight, viewportHeight);
+  if (wid <= 0)
+    return true;
+#if defined(GIF_OUTPUT_TRANSFORM)
+  if ((outputTransform & 1) && !posterBuffer) {
+    // Rotated 90 or 270 degrees, the display's lines are the frame's columns,
+    // which are all output at once
+    outputImageDataColumns(lineOutputX, lineOutputY, wid, yEnd - lineOutputY,
+                           lineSkip);
+    return true;
   }
-#if GIFDEBUG > 2
-  unsigned long filePositionBefore = filePositionCallback();
-  sprintf(buf,
-          "Frame %2d: [=%6ld P:0x%02X B:%d F:%dms] @ %d,%d %dx%d ms:", frameNo,
-          filePositionBefore, tbiPackedBits, transparentColorIndex,
-          frameDelay * 10, tbiImageX, tbiImageY, tbiWidth, tbiHeight);
-  Serial.print(buf);
-  delay(10); // allow Serial to complete @ 115200 baud
-  int32_t t = millis();
-#endif
-#endif
-  for (int state = 0; state < 4; state++) {
-    if (tbiInterlaced == 0)
-      state = 4; // regular does one pass
-    for (int line = starts[state]; line < tbiHeight; line += incs[state]) {
-      if (disposalMethod == DISPOSAL_BACKGROUND)
-        memset(imageBuf, prevBackgroundIndex, maxGifWidth);
-      //            int align = (lsdWidth > maxGifWidth) ? lsdWidth -
-      //            maxGifWidth : 0; int ofs = tbiImageX - align; uint8_t *dst =
-      //            (ofs < 0) ? imageBuf : imageBuf + ofs; align = (ofs < 0) ?
-      //            -ofs : 0; int align = 0;
-      lzw_decode(imageBuf + tbiImageX, tbiWidth,
-                           imageBuf + maxGifWidth); //, align);
-      //int len = lzw_decode(imageBuf + tbiImageX, tbiWidth,
-      //                     imageBuf + maxGifWidth); //, align);
-      // if (len != tbiWidth)
-      //    Serial.println(len);
-      int xofs = (disposalMethod == DISPOSAL_BACKGROUND) ? 0 : tbiImageX;
-      int wid = (disposalMethod == DISPOSAL_BACKGROUND) ? lsdWidth : tbiWidth;
-      int skip =
-          (disposalMethod == DISPOSAL_BACKGROUND) ? -1 : transparentColorIndex;
-      ;
-      if (drawLineCallback) {
-#if defined(USE_PALETTE565)
-        (*drawLineCallback)(xofs, line + tbiImageY, imageBuf + xofs, wid,
-                            palette565, skip);
-#endif
-      } else if (drawPixelCallback) {
-        for (int x = 0; x < wid; x++) {
-          uint8_t pixel = imageBuf[x + xofs];
-          if ((pixel != skip))
-            (*drawPixelCallback)(x + xofs, line + tbiImageY, palette[pixel].red,
-                                 palette[pixel].green, palette[pixel].blue);
-        }
-      }
+#endif
+#if GIF_IMAGEDATA_BITS < 8
+  uint8_t lineBuf[maxGifWidth];
+#endif
+  for (bool first = true; lineOutputY < yEnd; first = false) {
+    if (!first && budget && (uint32_t)(micros() - start) >= budget)
+      return false;
+    int y = lineOutputY++;
+#if GIF_IMAGEDATA_BITS < 8
+    if (imageDataBits < 8) {
+      unpackImageDataLine(lineBuf, imageData + (y * imageDataStride),
+                          lineOutputX, wid);
+      outputLine(lineOutputX, y, lineBuf, wid, lineSkip);
+      continue;
     }
-  }
-  // LZW doesn't parse through all the data, manually set position
-  fileSeekCallback(filePositionAfter);
-#if GIFDEBUG > 2
-  Serial.println(millis() - t);
 #endif
+    outputLine(lineOutputX, y, imageData + (y * imageDataStride) + lineOutputX,
+               wid, lineSkip);
+  }
+  return true;
+}
 #endif
-  // Make animation frame visible
-  // swapBuffers() call can take up to 1/framerate seconds to return (it waits
-  // until a buffer copy is complete) note the time before calling
 
-  // Hold until time to display new frame (see comment at start of function)
+// Make animation frame visible, updating the screen unless it's unchanged
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::presentFrame(bool updateScreen) {
+  // Hold until the frame's time on the timeline, then it stays up for its own
+  // delay.  The comparisons are signed so they work across micros() wrapping
   if (_delayAfterDecode) {
-    uint32_t t;
-    while (((t = micros()) - frameStartTime) < priorFrameDelay)
-      ;
-    cycleTime += frameDelay * 10;
-    if (updateScreenCallback) {
-      (*updateScreenCallback)();
+    resyncTimeline();
+    uint32_t presentationTime = timelineEpoch + timelinePosition;
+#if defined(GIF_PROFILING)
+    if (traceCallback && (int32_t)(micros() - presentationTime) > 0) {
+      (*traceCallback)(GIF_TRACE_LATE_PRESENT, GIF_PROFILE_CLOCK(),
+                       micros() - presentationTime);
     }
-    frameStartTime = t;
+#endif
+    GIF_PROFILE_PHASE(GIF_PHASE_WAIT);
+    if (stepping) {
+      // decodeStep() shows the frame when it's due, rather than waiting here
+      stepState = GIF_STEP_PRESENT;
+      stepUpdateScreen = updateScreen;
+      return;
+    }
+    while ((int32_t)(micros() - presentationTime) < 0)
+      ;
+    showFrame(updateScreen);
+  }
+}
+
+// After a stall, move the timeline on by whole frame delays until the frame
+// is due within one of them, rather than showing every frame that was due
+// during the stall as fast as they decode.  The epoch is left as it is, so
+// decoders sharing it stay in step.  The frame times skipped are counted as
+// dropped frames
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::resyncTimeline(void) {
+  int32_t late = micros() - (timelineEpoch + timelinePosition);
+  if (late <= GIF_RESYNC_LATENESS)
+    return;
+  uint32_t delay = frameDelay * 10000;
+  if (delay) {
+    droppedFrames += late / delay;
+    timelinePosition += late / delay * delay;
+  } else {
+    timelinePosition += late;
+  }
+}
+
+// The frame's presentation time has come: it's up for its delay from now
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::showFrame(bool updateScreen) {
+  cycleTime += frameDelay * 10;
+  timelinePosition += frameDelay * 10000;
+  GIF_PROFILE_PHASE(GIF_PHASE_OUTPUT);
+  if (updateScreen && updateScreenCallback) {
+    (*updateScreenCallback)();
   }
 }
@@ -38,18 +38,18 @@
 
 #include "GifDecoder.h"
 
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::lzw_setTempBuffer(
-    uint8_t *tempBuffer) {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::lzw_setTempBuffer(uint8_t *tempBuffer) {
   temp_buffer = tempBuffer;
 }
 
 // Initialize LZW decoder
 //   csize initial code size in bits
 //   buf input data
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::lzw_decode_init(
-    int csize) {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                pixelFormat>::lzw_decode_init(int csize) {
 
   // Initialize read buffer variables
   bbuf = 0;
@@ -70,8 +70,9 @@ void GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::lzw_decode_init(
 }
 
 //  Get one code of given number of bits from stream
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-inline int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::lzw_get_code() {
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+inline int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+                      pixelFormat>::lzw_get_code() {
 
   while (bbits < cursize) {
     if (bcnt == bs) {
@@ -117,10 +118,40 @@ inline int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::lzw_get_code() {
 //   buf 8 bit output buffer
 //   len number of pixels to decode
 //   returns the number of bytes decoded
-// .kbv add optional number of pixels to skip i.e. align
-template <int maxGifWidth, int maxGifHeight, int lzwMaxBits>
-int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::lzw_decode(
-    uint8_t *buf, int len, uint8_t *bufend) /*, int align)*/ {
+//   align number of leading pixels to decode without storing them
+// The part of the line that fits between buf and bufend is worked out once,
+// so lines that fit (nearly all of them) are decoded without checking bounds
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits, pixelFormat>::lzw_decode(
+    uint8_t *buf, int len, uint8_t *bufend, int align) {
+  int writable = bufend - buf;
+  if (writable < 0)
+    writable = 0;
+
+  if (align == 0 && len <= writable)
+    return lzw_decode_pixels(buf, len);
+
+  // The line overruns the buffer: discard the skipped pixels, store what
+  // fits, and discard the rest
+#if LZWDEBUG == 1
+  Serial.println("****** LZW imageData buffer overrun *******");
+#endif
+  if (align > len)
+    align = len;
+  if (writable > len - align)
+    writable = len - align;
+  int decoded = lzw_decode_pixels(NULL, align);
+  if (decoded == align)
+    decoded += lzw_decode_pixels(buf, writable);
+  if (decoded == align + writable)
+    decoded += lzw_decode_pixels(NULL, len - align - writable);
+  return decoded;
+}
+
+// Decode len pixels into buf, or just drop them if buf is NULL
+template <int maxGifWidth, int maxGifHeight, int lzwMaxBits, int pixelFormat>
+int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits,
+               pixelFormat>::lzw_decode_pixels(uint8_t *buf, int len) {
   int l, c, code;
   // Local copies of class member vars allows the compiler to save a few cycles
   const int newcode_l = newcodes;
@@ -141,28 +172,26 @@ int GifDecoder<maxGifWidth, maxGifHeight, lzwMaxBits>::lzw_decode(
   l = len;
 
   for (;;) {
-    while (sp_l > stack) {
-      uint8_t q = *(--sp_l); //.kbv pull off stack anyway
-      l--;
-      // load buf with data if we're still within bounds
-      if (buf < bufend) {
-        *buf++ = q; // a decent amount of time is spent here, but it's needed to
-                    // reverse the output of the lzw compressed strings
-      } else {
-        // out of bounds, keep incrementing the pointers, but don't use the data
-#if LZWDEBUG == 1
-        // only print this message once per call to lzw_decode
-        if (buf == bufend)
-          Serial.println("****** LZW imageData buffer overrun *******");
-#endif
-      }
-      if (l == 0) {
-        sp = sp_l; // store them back in the member vars
-        slot = slot_l;
-        top_slot = top_slot_l;
-        bbuf = bbuf_l;
-        return len;
-      }
+    // Take as much of the decoded string off the stack as the line needs
+    int n = sp_l - stack;
+    if (n > l)
+      n = l;
+    l -= n;
+    if (buf) {
+      // a decent amount of time is spent here, but it's needed to reverse
+      // the output of the lzw compressed strings
+      uint8_t *end = buf + n;
+      while (buf < end)
+        *buf++ = *(--sp_l);
+    } else {
+      sp_l -= n;
+    }
+    if (l == 0) {
+      sp = sp_l; // store them back in the member vars
+      slot = slot_l;
+      top_slot = top_slot_l;
+      bbuf = bbuf_l;
+      return len;
     }
     // about 15% of the time is spent here
     while (bbits < lzwMaxBits) {